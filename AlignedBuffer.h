@@ -0,0 +1,152 @@
+//AlignedBuffer.h
+#ifndef ALIGNED_BUFFER_H_
+#define ALIGNED_BUFFER_H_
+
+// Allocation of large buffers (frame buffers, structure of arrays) straight from mmap, so that they start on a page
+// boundary, which covers the 64 byte alignment of cache lines and vector registers, and can be backed by 2 MB huge
+// pages. A 4 KB page only covers a few rows of a large frame, so walking the frame misses the TLB every few rows,
+// whereas a 2 MB page covers hundreds of them. Buffers that are written once and not read back soon can be filled
+// with non-temporal stores, which skip reading the cache lines in before overwriting them; a buffer that is read
+// back right away is better off with regular stores, which leave it in the cache.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <emmintrin.h>
+#include <sys/mman.h>
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+enum struct PageSize
+{
+	Small,           // the 4 KB pages of the system
+	TransparentHuge, // 2 MB aligned and marked for transparent huge pages, which the kernel may or may not grant
+	ExplicitHuge     // 2 MB pages reserved through /proc/sys/vm/nr_hugepages
+};
+
+inline const char* getPageSizeName(PageSize pageSize)
+{
+	switch (pageSize)
+	{
+	case PageSize::Small:
+		return "small";
+	case PageSize::TransparentHuge:
+		return "transparent huge";
+	case PageSize::ExplicitHuge:
+		return "explicit huge";
+	}
+
+	return "unknown";
+}
+
+// The mapping is always rounded up to whole huge pages, whatever pages it is backed by, so that freeBuffer() only
+// needs the size. The pages past the end are never touched and cost nothing but address space.
+inline size_t getMappedSize(size_t size)
+{
+	return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+// Maps size bytes of zeroed memory with the given pages, falling back to transparent huge pages if there are no
+// explicit ones reserved, and sets pageSize to the pages asked for in the end. Returns nullptr if out of memory.
+inline void *allocateBuffer(size_t size, PageSize &pageSize)
+{
+	const size_t mappedSize = getMappedSize(size);
+
+	if (pageSize == PageSize::ExplicitHuge)
+	{
+		void *memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+		if (memory != MAP_FAILED)
+			return memory;
+
+		pageSize = PageSize::TransparentHuge;
+	}
+
+	if (pageSize == PageSize::Small)
+	{
+		void *memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return (memory != MAP_FAILED) ? memory : nullptr;
+	}
+
+	// map one huge page more than needed and cut off what lies outside the first 2 MB boundary
+	char *memory = static_cast<char *>(mmap(nullptr, mappedSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (memory == MAP_FAILED)
+		return nullptr;
+
+	char *aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(memory) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+	if (aligned > memory)
+		munmap(memory, aligned - memory);
+	munmap(aligned + mappedSize, memory + HUGE_PAGE_SIZE - aligned);
+
+	madvise(aligned, mappedSize, MADV_HUGEPAGE);
+	return aligned;
+}
+
+inline void freeBuffer(void *memory, size_t size)
+{
+	if (memory)
+		munmap(memory, getMappedSize(size));
+}
+
+// Allocates count default constructed elements of T, throws std::bad_alloc if out of memory. Like new T[] the pages
+// are left untouched for types without a constructor, only they come zeroed.
+template <typename T>
+T *allocateArray(size_t count, PageSize pageSize = PageSize::Small)
+{
+	T *array = static_cast<T *>(allocateBuffer(count * sizeof(T), pageSize));
+	if (!array)
+		throw std::bad_alloc();
+
+	if (!std::is_trivially_default_constructible<T>::value)
+		for (size_t i = 0; i < count; i++)
+			new (array + i) T();
+	return array;
+}
+
+// for arrays of trivially destructible T only, like the rest of this header
+template <typename T>
+void freeArray(T *array, size_t count)
+{
+	freeBuffer(array, count * sizeof(T));
+}
+
+// Copies size bytes to dst with non-temporal stores, apart from the bytes before the first and after the last 16 byte
+// boundary of dst. Non-temporal stores are not ordered with the others, so call _mm_sfence() once done with a batch of
+// them, before other threads may read it. A fence after every few KB costs more than the stores save.
+inline void streamStore(void *dst, const void *src, size_t size)
+{
+	char *d = static_cast<char *>(dst);
+	const char *s = static_cast<const char *>(src);
+
+	size_t head = (16 - reinterpret_cast<uintptr_t>(d) % 16) % 16;
+	if (head > size)
+		head = size;
+	std::memcpy(d, s, head);
+	d += head;
+	s += head;
+	size -= head;
+
+	for (; size >= 16; size -= 16, d += 16, s += 16)
+		_mm_stream_si128(reinterpret_cast<__m128i *>(d), _mm_loadu_si128(reinterpret_cast<const __m128i *>(s)));
+
+	std::memcpy(d, s, size);
+}
+
+// fills count floats from dst on with value using non-temporal stores
+inline void streamFill(float *dst, float value, size_t count)
+{
+	size_t i = 0;
+	for (; i < count && reinterpret_cast<uintptr_t>(dst + i) % 16; i++)
+		dst[i] = value;
+
+	const __m128 _value = _mm_set1_ps(value);
+	for (; i + 4 <= count; i += 4)
+		_mm_stream_ps(dst + i, _value);
+
+	for (; i < count; i++)
+		dst[i] = value;
+	_mm_sfence();
+}
+
+#endif
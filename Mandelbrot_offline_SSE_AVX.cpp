@@ -36,51 +36,121 @@ overhead of creating the threads might be too high.
 NOTE: 
 ----
 
-[1] Running the application at high enough resolutions can be memory intensive. 
+[1] Running the application at high enough resolutions can be memory intensive, since the whole frame is kept
+in memory at 12 bytes per pixel. For very large frames, use the tiled mode instead. It renders the frame in
+small tiles that are written straight to a memory mapped output file, so the memory used depends only on the
+tile size and the number of threads.
 
-[2] To compile the program make sure to set the appropriate compiler flags to generate vector code for your 
-processor specific architecture The SIMD instructions used here support both SSE and AVX, depending on
-the platform of choice. Since AVX uses 8 wide registers whereas SSE uses 4 wide ones, the AVX code
-should be roughly twice as fast when tested on the same system. 
+[2] The SIMD instructions used here support SSE, AVX and AVX-512. Since AVX uses 8 wide registers whereas
+SSE uses 4 wide ones, the AVX code should be roughly twice as fast when tested on the same system. All three
+kernels are compiled into the same binary using per-function target attributes, and the widest instruction
+set supported by the host processor (and enabled by the operating system) is picked at startup via CPUID.
+A single binary can therefore be deployed across machines with different processors.
 
 [3] If this program is being run on a system with more than 64 logical cores under WSL please
 see https://github.com/sirredbeard/WSL2-more-cores. If this program is run under Windows on 
 a system that has more than 64 logial cores, special changes need to made concering processor
 groups. Such features have not been implemented yet.
 
+[4] By default the whole set is rendered over (-2.5, 1) x (-1, 1), but any view can be chosen by giving its
+center and a zoom factor. Single precision floats run out of digits at zooms of around 1e5, so deeper views are
+automatically rendered with double precision kernels (scalar, AVX and AVX-512). Past a zoom of about 1e13 even
+doubles are not enough, and the renderer switches to perturbation theory. A single reference orbit is computed in
+double-double arithmetic (about 32 digits) and every pixel only tracks its small offset from it in double precision.
+This allows zooms down to around 1e-30 at roughly the cost of a double precision render.
+
+[5] Points inside the set are the most expensive ones to render, since they are iterated all the way up to the
+maximum number of iterations. Optionally, the scalar and SIMD kernels can skip points that lie in the main cardioid
+or the period-2 bulb (both have closed forms) and stop iterating orbits that have settled onto a cycle, which is
+detected with Brent's algorithm. At 10000 iterations this makes the default view 10x to 80x faster depending on the
+kernel. Run the program with "--benchmark-interior [width height iterations]" to measure it. The deep zoom
+perturbation renderer does not use these checks.
+
+[6] Alternatively, the Mariani-Silver algorithm can be used. It only evaluates the border of a rectangle, fills the
+rectangle if the whole border has the same iteration count and otherwise splits it into four and recurses, with the
+four parts running as OpenMP tasks. Large regions inside the set are then filled instead of iterated, which makes it
+several times faster at high iteration counts. Since this relies on the set being connected, an isolated pixel can
+occasionally come out differently. It falls well short of an order of magnitude fewer evaluations, though: outside
+the set neighbouring pixels mostly escape after different numbers of iterations, so only the inside of the set and
+the widest bands around it are filled. On the default view it evaluates 3.4x fewer pixels at 1024 x 768, 4x fewer
+at 1920 x 1080 and 5.4x fewer at 3840 x 2160, at any number of iterations. The borders are evaluated with the SIMD
+kernels, which makes it 1.6x (1024 x 768, 1000 iterations) to 3.4x (1920 x 1080, 5000 iterations) faster than the
+full AVX-512 render without the interior checks, which take away most of its advantage.
+
+[7] A progressive mode renders every 16th row first and then halves the step with every pass, filling the rows not yet
+rendered with copies, so that a coarse preview is ready after a fraction of the full render time.
+
+[8] Every kernel can also store plain iteration counts, 16 or 32 bits per pixel, optionally along with a smooth
+fraction, instead of colors. These are colored in a separate pass through a palette lookup table, which can also be
+histogram equalized so that the colors spread evenly over the frame at any number of iterations.
+
+[9] For anti-aliasing, every pixel can be covered by k x k jittered sub-samples, which are packed into the lanes of
+the AVX and AVX-512 kernels. Adaptive supersampling only does so for pixels that differ from their neighbours.
+
+[10] Zoom animations can be rendered without any prompts with "--animate keyframes.txt frames [width height
+iterations [prefix]]". Every line of the keyframe file holds the real and the imaginary part of a center and a
+zoom factor. The frames are spread evenly over the keyframes, zooming at a constant rate in between, and are written
+to prefix_00000.ppm and onwards. While a frame is being rendered, the previous one is encoded and written out in
+the background. The two frame buffers and the reference orbit of the deep zoom renderer are reused between frames.
+
+[11] The STL thread renderer hands out small tiles through per-thread deques, and threads that run out of tiles
+steal them from the others, so the threads rendering the interior of the set no longer hold everyone up. Run the
+program with "--benchmark-mt [width height iterations]" to compare it to a static split into bands.
+
+[12] For regression tracking, "--benchmark" times the backends without any prompts and prints the minimum, median
+and 99th percentile time, along with Mpixels/s and Giterations/s, as JSON or CSV. The options are
+"--size width height", "--iterations n", "--backends scalar,omp,mt,sse,avx,avx512", "--threads n",
+"--repetitions n", "--interior", "--placement main|first-touch|interleave", "--pin" and "--format json|csv".
+Giterations/s is the sum of the iteration counts of the frame over the time, which counts MAX_ITR iterations for
+every point inside the set. With "--interior" most of those are skipped or cut short, so the figure then overstates
+the iterations actually run and is only comparable between runs with the same interior checks.
+
+[13] Besides the Mandelbrot set, the Julia sets (Z_0 is the point and C is fixed), the Burning Ship (the parts of Z
+are made positive before squaring) and the Multibrot sets (Z^d + C for an integer power d) can be rendered. They all
+go through a single generic escape-time loop, which is written once against a small set of vector operations and
+instantiated for every instruction set and fractal, so every renderer supports them with the same vectorization.
+They are rendered in single precision only.
+
+[14] "--farm workers [width height iterations [threads]]" renders the default view with a local render farm. The
+frame is split into tiles, which are handed out over Unix domain sockets to the given number of worker processes,
+each running the SIMD kernels with the given number of threads. The workers send back the iteration counts, which
+are colored and written out by the coordinating process. If a worker crashes, or takes more than 30 seconds for a
+tile, it is dropped and its tiles go to the other workers.
+
+[15] The frame buffer is mapped without being touched, so that its pages land on the NUMA nodes of the threads that
+render them rather than all on the node of the main thread. When asked to pin the render threads to logical
+processors, every thread touches the rows it is going to render first, otherwise the pages are interleaved over all
+the nodes. The benchmark takes either placement, or the old one through "--placement main", and reports the share of
+pages that were written from a remote node.
+
+[16] Frame buffers come from the allocator in AlignedBuffer.h, which is shared with soa.cpp and has to sit next to
+this file. They are aligned to at least 64 bytes and can be backed by 2 MB pages ("--pages small|transparent|explicit"
+in the benchmark). The renderers that draw a whole frame and only then save it write the colors out with
+non-temporal stores, which do not read the frame buffer into the caches first. The tiled and progressive renderers
+and the rows streamed to the PPM file are read back straight away, so they keep regular stores.
+"--benchmark-memory [width height]" colors a large frame with every kind of page, with and without non-temporal
+stores, and prints the store bandwidth along with the data TLB misses where perf events are allowed.
+
 COMPILATION DETAILS:
 -------------------
 
 I have tested on GCC 9.4.0 with the following flags: 
 
-SSE: "-fopenmp -pthread -O3 -std=c++17 -msse4.1 -DISA_SSE" 
-----------------------------------------------------------
-
-to enable and/or link OpenMP, pthreads, full optimizations, C++17,
-SSE4.1 instruction set respectively.
-
-AVX: "-fopenmp -pthread -O3 -std=c++17 -mavx2 -mfma -DISA_AVX" 
---------------------------------------------------------------
-
-to enable and/or link OpenMP, pthreads, full optimizations, C++17,
-AVX2 instruction set and Fused Multiply Add respectively.
+"-fopenmp -pthread -O3 -std=c++17"
+---------------------------------
 
-AVX-512: "-fopenmp -pthread -O3 -std=c++17 -mavx512f -mfma -DISA_AVX512"
------------------------------------------------------------------------
+to enable and/or link OpenMP, pthreads, full optimizations and C++17 respectively.
 
-to enable and/or link OpenMP, pthreads, full optimizations, C++17,
-AVX-512F instruction set and Fused Multiply Add respectively.
+No instruction set specific flags (-msse4.1, -mavx2, -mfma, -mavx512f) are needed. The SSE kernel is compiled
+for SSE4.1, the AVX kernel for AVX2 + FMA and the AVX-512 kernel for AVX-512F + FMA through the target attribute
+on each kernel, while the rest of the program is compiled for the baseline architecture. This requires GCC or
+Clang. The older compiler definitions ISA_SSE, ISA_AVX and ISA_AVX512 are no longer needed.
 
-The compiler definitions ISA_SSE, ISA_AVX, ISA_AVX512 enable/disable platform specific intrinsics code.
-Note that the SSE code will run on a system that supports AVX but the AVX code will *not* run
-on a system that *only* supports upto SSE. Also, SSE and AVX *cannot* be enabled at the same time.
-This is by design. In case one needs to test out both the implementations, two binaries need to be
-compiled for SSE and AVX using the flags -DISA_SSE and -DISA_AVX respectively. Same applies for
-AVX-512 instructions.
-
-TODO: The AVX implementation has slight rendering differences compared to the non-SIMD OpenMP and
-the single core versions. This is probably due to subtle precision errors in the AVX implementation.
-Needs further investigation for a fix.
+The SIMD kernels render slightly differently from the scalar ones near the boundary of the set. They map pixels to
+the plane with a single FMA instead of the scalar mapping, and GCC contracts their multiplies and adds into FMAs,
+which round once instead of twice. Both are turned off by adding "-DSTRICT_FP", after which every kernel matches
+the scalar kernel of its precision bit for bit, at little if any cost in speed. Run the program with "--verify [width
+height iterations [centerX centerY zoom]]" to compare the iteration counts of every kernel with the scalar ones.
 
 To know more about the Mandelbrot set, please refer to https://en.wikipedia.org/wiki/Mandelbrot_set
 
@@ -103,11 +173,49 @@ Resources on SSE/AVX intrinsics:
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cmath>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
 #include <omp.h>
 #include <immintrin.h>
+#include <cpuid.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <csignal>
+#include <poll.h>
+#include <new>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+
+#include "AlignedBuffer.h"
+
+// Building with -DSTRICT_FP stops GCC from contracting multiplies and adds into FMAs, and makes the SIMD kernels map
+// pixels to the plane like the scalar ones, so that every kernel evaluates a pixel with the same roundings
+#ifdef STRICT_FP
+#pragma GCC optimize ("fp-contract=off")
+#endif
 
 struct Color3f
 {
@@ -196,6 +304,120 @@ struct Complex // class to support Complex numbers
 	}
 };
 
+struct DoubleDouble // unevaluated sum of two doubles, good for about 32 significant decimal digits
+{
+	double hi;
+	double lo;
+	
+	DoubleDouble() : hi(0), lo(0) {}
+	DoubleDouble(double hi_, double lo_ = 0) : hi(hi_), lo(lo_) {}
+	
+	inline DoubleDouble operator+(const DoubleDouble &d) const // addition
+	{
+		double s = hi + d.hi;
+		double v = s - hi;
+		double e = (hi - (s - v)) + (d.hi - v) + lo + d.lo;
+		double h = s + e;
+		return DoubleDouble(h, e - (h - s));
+	}
+	
+	inline DoubleDouble operator-() const // negation
+	{
+		return DoubleDouble(-hi, -lo);
+	}
+	
+	inline DoubleDouble operator-(const DoubleDouble &d) const // subtraction
+	{
+		return *this + (-d);
+	}
+	
+	inline DoubleDouble operator*(const DoubleDouble &d) const // multiplication
+	{
+		double p = hi * d.hi;
+		double e = std::fma(hi, d.hi, -p) + hi * d.lo + lo * d.hi;
+		double h = p + e;
+		return DoubleDouble(h, e - (h - p));
+	}
+	
+	inline DoubleDouble operator/(const double &d) const // scalar division
+	{
+		double q = hi / d;
+		DoubleDouble r = *this - DoubleDouble(q) * DoubleDouble(d);
+		return DoubleDouble(q) + DoubleDouble(r.hi / d);
+	}
+	
+	double toDouble() const
+	{
+		return hi + lo;
+	}
+};
+
+// parses a decimal number like "-1.7400623825793399052e-3" without losing the digits a double cannot hold
+DoubleDouble parseDoubleDouble(const std::string &str)
+{
+	DoubleDouble value;
+	size_t i = 0;
+	int exponent = 0;
+	bool negative = false, fraction = false;
+	
+	if (i < str.size() && (str[i] == '-' || str[i] == '+'))
+		negative = (str[i++] == '-');
+	
+	for (; i < str.size(); ++i)
+	{
+		if (str[i] == '.')
+			fraction = true;
+		else if (str[i] >= '0' && str[i] <= '9')
+		{
+			value = value * DoubleDouble(10) + DoubleDouble(str[i] - '0');
+			exponent -= fraction;
+		}
+		else if (str[i] == 'e' || str[i] == 'E')
+		{
+			exponent += std::atoi(str.c_str() + i + 1);
+			break;
+		}
+		else
+			break;
+	}
+	
+	for (; exponent > 0; --exponent)
+		value = value * DoubleDouble(10);
+	for (; exponent < 0; ++exponent)
+		value = value / 10;
+	
+	return negative ? -value : value;
+}
+
+struct Viewport // region of the complex plane that is mapped onto the frame
+{
+	DoubleDouble centerX; // real part of the center of the frame
+	DoubleDouble centerY; // imaginary part of the center of the frame
+	double scale; // zoom factor, 1 maps the frame to (-2.5, 1) x (-1, 1)
+	
+	Viewport() : centerX(-0.75), centerY(0), scale(1) {}
+	
+	double getWidth() const // extent along the real axis
+	{
+		return 3.5 / scale;
+	}
+	
+	double getHeight() const // extent along the imaginary axis
+	{
+		return 2 / scale;
+	}
+	
+	double getMinX() const
+	{
+		return (centerX - DoubleDouble(0.5 * getWidth())).toDouble();
+	}
+	
+	double getMinY() const
+	{
+		return (centerY - DoubleDouble(0.5 * getHeight())).toDouble();
+	}
+};
+
 /*============================ COLORS ================================*/
 
 Color3f BLACK(0, 0, 0);
@@ -210,6 +432,47 @@ Color3f YELLOW(1, 1, 0);
 /*=====================================================================*/
 
 uint32_t MAX_ITR = 0;
+Viewport view;
+bool interiorChecks = false; // skips the iterations of points that are known to be inside the set
+
+enum struct FractalType
+{
+	Mandelbrot,
+	Julia,
+	BurningShip,
+	Multibrot
+};
+
+// the escape-time fractal being rendered, everything but the Mandelbrot set goes through the generic fractal engine
+struct Fractal
+{
+	FractalType type = FractalType::Mandelbrot;
+	float juliaR = -0.123f, juliaI = 0.745f; // the fixed C of the Julia set, Douady's rabbit by default
+	int power = 3; // the power of Z in the Multibrot set
+};
+
+Fractal fractal;
+
+const char* getFractalName(FractalType type)
+{
+	switch (type)
+	{
+		case (FractalType::Julia):
+			return "Julia set";
+
+		case (FractalType::BurningShip):
+			return "Burning Ship";
+
+		case (FractalType::Multibrot):
+			return "Multibrot set";
+
+		default:
+			return "Mandelbrot set";
+	}
+}
+
+// invoked by the renderers with the index of every row as soon as it has been completely written to the frame buffer
+typedef std::function<void(int)> RowCallback;
 
 void saveImg(const Color3f *frameBuffer, int width, int height)
 {
@@ -225,614 +488,3945 @@ void saveImg(const Color3f *frameBuffer, int width, int height)
 		out << static_cast<int>(frameBuffer[i].r * 255.99) << " " << static_cast<int>(frameBuffer[i].g * 255.99) << " " << static_cast<int>(frameBuffer[i].b * 255.99) << "\n";
 }
 
-// maps pixel values in the X direction of screen space between (-2.5, 1)
-float getMappedScaleX(const int &x, const int &xMax)
+/*========================== BINARY PPM (P6) =========================*/
+
+const size_t IMG_CHUNK_BYTES = 8 << 20; // size of each staging buffer used by the binary writer
+
+// converts a span of pixels to packed 8-bit RGB triplets
+void packRGB8(const Color3f *src, uint8_t *dst, size_t count)
 {
-	return ((x / (float) xMax) * 3.5) - 2.5;
+#pragma omp simd
+	for (size_t i = 0; i < count; ++i)
+	{
+		dst[3 * i] = static_cast<uint8_t>(src[i].r * 255.99f);
+		dst[3 * i + 1] = static_cast<uint8_t>(src[i].g * 255.99f);
+		dst[3 * i + 2] = static_cast<uint8_t>(src[i].b * 255.99f);
+	}
 }
 
-// maps pixel values in the Y direction of screen space between (-1, 1)
-float getMappedScaleY(const int &y, const int &yMax)
+// keeps writing until all the bytes are on their way to the disk or an error occurs
+bool writeAll(int fd, const uint8_t *data, size_t size, off_t offset)
 {
-	return ((y / (float) yMax) * 2) - 1;
+	while (size > 0)
+	{
+		ssize_t written = pwrite(fd, data, size, offset);
+		if (written < 0)
+			return false;
+		data += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
 }
 
-void evalMandel(Complex &z, const Complex &c)
+// opens the output file and writes out the P6 header, returns the file descriptor and the size of the header
+int openPPM(const char *outputPath, int width, int height, off_t &headerSize)
 {
-	float zReal = z.a;
-	float zImaginary = z.b;
-	z.a = zReal * zReal - zImaginary * zImaginary + c.a;
-	z.b = 2 * zReal * zImaginary + c.b;
+	int fd = open(outputPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		std::cerr << "Could not open " << outputPath << " for writing. Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+	if (!writeAll(fd, reinterpret_cast<const uint8_t *>(header.data()), header.size(), 0))
+	{
+		std::cerr << "Could not write to " << outputPath << ". Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	headerSize = header.size();
+	return fd;
 }
 
-/********************************************INTRINSICS BEGIN*****************************************/
-
-/////////////////////////////////////////////// SSE BEGIN /////////////////////////////////////////////
-
-#ifdef ISA_SSE
+// Writes the frame buffer as a binary PPM. The frame is converted to 8-bit RGB in chunks of rows using all the
+// threads, and each chunk is written out with a single large write while the next chunk is being converted.
+void saveImgP6(const Color3f *frameBuffer, int width, int height, const char *outputPath = "Mandelbrot.ppm")
+{
+	std::cout << "Writing out frame buffer to file..." << std::endl;
+	
+	off_t offset = 0;
+	int fd = openPPM(outputPath, width, height, offset);
+	
+	const size_t rowBytes = static_cast<size_t>(width) * 3;
+	const int chunkRows = std::max(1, static_cast<int>(IMG_CHUNK_BYTES / rowBytes));
+	
+	std::vector<uint8_t> staging[2];
+	staging[0].resize(chunkRows * rowBytes);
+	staging[1].resize(chunkRows * rowBytes);
+	std::future<bool> pending[2];
+	bool ok = true;
+	
+	for (int y0 = 0, chunk = 0; y0 < height; y0 += chunkRows, chunk ^= 1)
+	{
+		int rows = std::min(chunkRows, height - y0);
+		
+		// the staging buffer is reused every other chunk, so its previous write must have finished
+		if (pending[chunk].valid())
+			ok &= pending[chunk].get();
+		
+		uint8_t *dst = staging[chunk].data();
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < rows; ++y)
+			packRGB8(frameBuffer + static_cast<size_t>(y0 + y) * width, dst + y * rowBytes, width);
+		
+		size_t size = rows * rowBytes;
+		pending[chunk] = std::async(std::launch::async, writeAll, fd, dst, size, offset);
+		offset += size;
+	}
+	
+	for (int i = 0; i < 2; ++i)
+		if (pending[i].valid())
+			ok &= pending[i].get();
+	
+	close(fd);
+	
+	if (!ok)
+	{
+		std::cerr << "Could not write to " << outputPath << ". Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+}
 
-void drawMandelbrotOMPSSE(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads)
+// Streams rows of a frame to a binary PPM while the rest of the frame is still being rendered. The render threads
+// convert their finished rows to 8-bit RGB and hand them over to a dedicated writer thread, which gathers whatever
+// rows have arrived and writes runs of consecutive rows at their final offsets with vectored writes. Rows may
+// therefore arrive in any order.
+class PPMStreamWriter
 {
-	float invW = (1./ width) * 3.5, invH = (1./ height) * 2;
-#pragma omp parallel num_threads(nThreads) shared(frameBuffer)
+	
+public:
+	PPMStreamWriter(int width_, int height_, const char *outputPath_ = "Mandelbrot.ppm") :
+		width(width_),
+		height(height_),
+		rowBytes(static_cast<size_t>(width_) * 3),
+		outputPath(outputPath_),
+		isFinished(false),
+		hasFailed(false)
+	{
+		fd = openPPM(outputPath, width, height, dataOffset);
+		writer = std::thread([this]() { writeRows(); });
+	}
+	
+	~PPMStreamWriter()
 	{
+		finish();
+	}
 	
-		// 32-bit float registers
-		__m128 _zr, _zi, _cr, _ci, _a, _b, _zr2, _zi2, _const2, _invw, _invh, _const2p5,
-				_const1, _mod, _const4, _maskwhile, _xf, _yf; 
+	// converts a finished row and queues it for writing, safe to call from any thread
+	void pushRow(int y, const Color3f *row)
+	{
+		uint8_t *bytes = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			if (!freeRows.empty())
+			{
+				bytes = freeRows.back();
+				freeRows.pop_back();
+			}
+		}
 		
-		// 32-bit signed int registers
-		__m128i _masknumitr, _itr, _constmaxitr, _inc1i, _const1i;
+		if (!bytes)
+			bytes = new uint8_t[rowBytes];
 		
-		// initialize floating point registers
-		_const1 = _mm_set1_ps(1.0);
-		_const2 = _mm_set1_ps(2.0);
-		_const4 = _mm_set1_ps(4.0);
-		_const2p5 = _mm_set1_ps(2.5);
+		packRGB8(row, bytes, width);
 		
-		_invw = _mm_set1_ps(invW);
-		_invh = _mm_set1_ps(invH);	
+		std::unique_lock<std::mutex> lock(queueMutex);
+		finishedRows.emplace_back(y, bytes);
+		queueCV.notify_one();
+	}
+	
+	// writes out the remaining rows and closes the file
+	void finish()
+	{
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			if (isFinished)
+				return;
+			isFinished = true;
+		}
 		
-		// initialize integer registers
-		_constmaxitr = _mm_set1_epi32(MAX_ITR);	
-		_const1i = _mm_set1_epi32(1);	
+		queueCV.notify_one();
+		writer.join();
+		close(fd);
 		
-#pragma omp for schedule(dynamic, 1) 
-		for (int y = 0; y < height; y++) // y axis of the image	
+		for (uint8_t *bytes : freeRows)
+			delete[] bytes;
+		freeRows.clear();
+		
+		if (hasFailed)
 		{
-			int yw = y * width;
-			_yf = _mm_set1_ps((float)y);
-			
-			for (int x = 0; x < width; x += 4) // x axis of the image
-			{			
-				_xf = _mm_setr_ps((float)x + 3, (float)x + 2, (float)x + 1, (float)x);							
-				
-				// int index = y * width + x;			
-				int index0 = yw + x; // y * width + x
-				int index1 = yw + x + 1; // y * width + (x + 1)
-				int index2 = yw + x + 2; // y * width + (x + 2)
-				int index3 = yw + x + 3; // y * width + (x + 3)			
-				
-				// int itr = 0;	
-				_itr = _mm_set1_epi32(0); // initialize iteration counter for each pixel
-				
-				// float zr = 0, zi = 0, cr = 0, ci = 0; [ Complex z, c ]				
-				_zr = _mm_set1_ps(0);
-				_zi = _mm_set1_ps(0);
-				_cr = _mm_set1_ps(0);
-				_ci = _mm_set1_ps(0);
-				
-				// getMappedScaleX(const int &x, const int &xMax)
-				
-				// cr = (x * invW) - 2.5;			
-				// _cr =  _mm_fmadd_ps(_xf, _invw, _const2p5neg); // No FMA on my Nehalem CPU			 
-				_cr = _mm_mul_ps(_xf, _invw);
-				_cr = _mm_sub_ps(_cr, _const2p5);	
-
-				// getMappedScaleY(const int &y, const int &yMax)
-				
-				// ci = (y * invH) - 1;			
-				// _ci =  _mm_fmadd_ps(_yf, _invh, _const1neg);  // No FMA on my Nehalem CPU
-				_ci = _mm_mul_ps(_yf, _invh);
-				_ci = _mm_sub_ps(_ci, _const1);		
-
-				///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
-				
-				loop: // while (...)
-					
-				_zr2 = _mm_mul_ps(_zr, _zr); // zr * zr
-				_zi2 = _mm_mul_ps(_zi, _zi); // zi * zi
-				_mod = _mm_add_ps(_zr2, _zi2); // zr * zr + zi * zi			
-					
-				_masknumitr = _mm_cmplt_epi32(_itr, _constmaxitr); // itr < MAX_ITR	
-				_maskwhile = _mm_cmple_ps(_mod, _const4); // zr * zr + zi * zi <= 4.0					
-				_maskwhile = _mm_and_ps(_maskwhile, _mm_castsi128_ps(_masknumitr)); // (zr * zr + zi * zi <= 4.0 && itr < MAX_ITR)
-				
-				
-				//////////////////////// evalMandel(z, c)//////////////////////////////////
-				
-				_a = _zr;
-				_b = _zi;
-				
-				_zr = _mm_sub_ps(_zr2, _zi2); // zr = zr * zr - zi * zi
-				_zr = _mm_add_ps(_zr, _cr); // zr += cr
-				
-				_zi = _mm_mul_ps(_a, _b); // zi = a * b
-				
-				// zi = zi * 2 + ci
-				// _zi = _mm_fmadd_ps(_zi, _const2, _ci); // No FMA on my Nehalem CPU
-				_zi = _mm_mul_ps(_zi, _const2);
-				_zi = _mm_add_ps(_zi, _ci);
-				
-				//////////////////////// evalMandel(z, c)//////////////////////////////////
-				
-				
-				// itr++;
-				_inc1i = _mm_and_si128(_mm_castps_si128(_maskwhile), _const1i);
-				_itr = _mm_add_epi32(_itr, _inc1i);				
-				
-				// if (any one register satisfies while condition) goto loop;
-				if (_mm_movemask_ps(_maskwhile) > 0)
-					goto loop;
-				
-				///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+			std::cerr << "Could not write to " << outputPath << ". Aborting..." << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	
+private:
+	
+	void writeRows()
+	{
+		std::vector<std::pair<int, uint8_t *>> batch;
+		std::vector<iovec> iov;
+		
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCV.wait(lock, [this]() { return !finishedRows.empty() || isFinished; });
 				
-				// if (itr < MAX_ITR) frameBuffer[index] = BLACK;
-				// else frameBuffer[index] = CYAN;
+				if (finishedRows.empty() && isFinished)
+					break;
 				
-				// pixel masks read in correct endianness |3, 2, 1, 0| instead of |0, 1, 2, 3| 
-				int pixel0 = _mm_extract_epi32(_masknumitr, 3);
-				int pixel1 = _mm_extract_epi32(_masknumitr, 2);
-				int pixel2 = _mm_extract_epi32(_masknumitr, 1);
-				int pixel3 = _mm_extract_epi32(_masknumitr, 0);
+				batch.swap(finishedRows);
+			}
+			
+			std::sort(batch.begin(), batch.end());
+			
+			// coalesce runs of consecutive rows into one vectored write each
+			for (size_t i = 0; i < batch.size();)
+			{
+				size_t j = i;
+				iov.clear();
+				while (j < batch.size() && batch[j].first == batch[i].first + static_cast<int>(j - i) && iov.size() < IOV_MAX)
+				{
+					iov.push_back({ batch[j].second, rowBytes });
+					++j;
+				}
 				
-				frameBuffer[index0] = pixel0 ? BLACK : CYAN;
-				frameBuffer[index1] = pixel1 ? BLACK : CYAN;
-				frameBuffer[index2] = pixel2 ? BLACK : CYAN;
-				frameBuffer[index3] = pixel3 ? BLACK : CYAN;		
+				if (!hasFailed)
+					hasFailed = !writeRowRun(batch[i].first, iov);
+				i = j;
 			}
+			
+			std::unique_lock<std::mutex> lock(queueMutex);
+			for (auto &row : batch)
+				freeRows.push_back(row.second);
+			batch.clear();
 		}
-	}		
-}
-
-#endif // ISA_SSE
-
-/////////////////////////////////////////////// SSE END ///////////////////////////////////////////////
-
+	}
+	
+	bool writeRowRun(int y, std::vector<iovec> &iov)
+	{
+		off_t offset = dataOffset + static_cast<off_t>(y) * rowBytes;
+		size_t remaining = iov.size() * rowBytes;
+		iovec *vec = iov.data();
+		int count = static_cast<int>(iov.size());
+		
+		while (remaining > 0)
+		{
+			ssize_t written = pwritev(fd, vec, count, offset);
+			if (written < 0)
+				return false;
+			
+			offset += written;
+			remaining -= written;
+			
+			// skip over whatever part of the run made it out in case of a partial write
+			while (count > 0 && static_cast<size_t>(written) >= vec->iov_len)
+			{
+				written -= vec->iov_len;
+				++vec;
+				--count;
+			}
+			if (count > 0)
+			{
+				vec->iov_base = static_cast<uint8_t *>(vec->iov_base) + written;
+				vec->iov_len -= written;
+			}
+		}
+		return true;
+	}
+	
+	const int width;
+	const int height;
+	const size_t rowBytes;
+	const char *outputPath;
+	
+	int fd;
+	off_t dataOffset;
+	
+	std::vector<std::pair<int, uint8_t *>> finishedRows;
+	std::vector<uint8_t *> freeRows;
+	
+	std::mutex queueMutex;
+	std::condition_variable queueCV;
+	std::thread writer;
+	
+	bool isFinished;
+	bool hasFailed;
+};
 
+/*=====================================================================*/
 
-/////////////////////////////////////////////// AVX BEGIN /////////////////////////////////////////////
+// maps pixel values in the X direction of screen space to the real axis of the view, (-2.5, 1) by default
+float getMappedScaleX(const int &x, const int &xMax)
+{
+	return ((x / (float) xMax) * view.getWidth()) + view.getMinX();
+}
 
-#ifdef ISA_AVX
+// maps pixel values in the Y direction of screen space to the imaginary axis of the view, (-1, 1) by default
+float getMappedScaleY(const int &y, const int &yMax)
+{
+	return ((y / (float) yMax) * view.getHeight()) + view.getMinY();
+}
 
-void drawMandelbrotOMPAVX(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads)
+#ifdef STRICT_FP
+// maps the pixels x to x + lanes - 1 exactly like getMappedScaleX(), for the SIMD kernels to load into their lanes
+inline void getMappedScalesX(float *cr, int x, int lanes, const int &xMax)
 {
-	float invW = (1. / width) * 3.5, invH = (1. / height) * 2;	
-	
-#pragma omp parallel num_threads(nThreads) shared(frameBuffer)
-	{	
-		// 32-bit float registers
-		__m256 _zr, _zi, _cr, _ci, _a, _b, _zr2, _zi2, _const2, _invw, _invh, _const2p5neg,
-			_const1neg, _mod, _const4, _maskwhile, _xf, _yf;
+	for (int k = 0; k < lanes; k++)
+		cr[k] = getMappedScaleX(x + k, xMax);
+}
+#endif
 
-		// 32-bit signed int registers
-		__m256i _masknumitr, _itr, _constmaxitr, _inc1i, _const1i;
+void evalMandel(Complex &z, const Complex &c)
+{
+	float zReal = z.a;
+	float zImaginary = z.b;
+	z.a = zReal * zReal - zImaginary * zImaginary + c.a;
+	z.b = 2 * zReal * zImaginary + c.b;
+}
 
+// The main cardioid and the period-2 bulb make up most of the area of the set, and every point inside them
+// would otherwise be iterated all the way up to MAX_ITR. Both have closed forms:
+//
+//		cardioid: q * (q + (a - 1/4)) <= b^2 / 4 [ where q = (a - 1/4)^2 + b^2 and C = a + bi ]
+//		bulb:     (a + 1)^2 + b^2 <= 1/16
+//
+template <typename T>
+inline bool isInCardioidOrBulb(T cr, T ci)
+{
+	T ci2 = ci * ci;
+	T xq = cr - T(0.25);
+	T q = xq * xq + ci2;
+	if (q * (q + xq) <= T(0.25) * ci2)
+		return true;
+	return (cr + 1) * (cr + 1) + ci2 <= T(0.0625);
+}
 
-		// initialize floating point registers
-		_const1neg = _mm256_set1_ps(-1.0);
-		_const2 = _mm256_set1_ps(2.0);
-		_const4 = _mm256_set1_ps(4.0);
-		_const2p5neg = _mm256_set1_ps(-2.5);
+// iterates the fractals other than the Mandelbrot set, see the FRACTAL ENGINE section
+uint32_t getFractalIterations(const Complex &c, float *modulus);
 
-		_invw = _mm256_set1_ps(invW);
-		_invh = _mm256_set1_ps(invH);
+// Iterates Z from 0 and returns the number of iterations before it escapes, or MAX_ITR if it never does. With the
+// interior checks enabled, points in the cardioid or the bulb are skipped, and the orbit is checked for cycles the
+// way Brent's algorithm does: Z is compared against a value saved at every power of two iterations. An orbit that
+// comes back to exactly the same value is periodic and thus never escapes. In finite precision the orbits of
+// interior points quickly settle onto such exact cycles. If modulus is given, it receives |Z|^2 of the escaped Z.
+uint32_t getIterations(const Complex &c, float *modulus = nullptr)
+{
+	if (fractal.type != FractalType::Mandelbrot)
+		return getFractalIterations(c, modulus);
 
-		// initialize integer registers
-		_constmaxitr = _mm256_set1_epi32(MAX_ITR);
-		_const1i = _mm256_set1_epi32(1);	
+	if (interiorChecks && isInCardioidOrBulb(c.a, c.b))
+		return MAX_ITR;
+	
+	uint32_t itr = 0, period = 0, periodLength = 1;
+	Complex z, saved;
+	while (z.real() * z.real() + z.imaginary() * z.imaginary() <= 2 * 2 && itr < MAX_ITR)
+	{
+		evalMandel(z, c);
+		itr++;
 		
-#pragma omp for schedule(dynamic, 1) 
-		for (int y = 0; y < height; y++) // y axis of the image	
+		if (interiorChecks)
 		{
-			int yw = y * width;
-			_yf = _mm256_set1_ps((float) y);
+			if (z.a == saved.a && z.b == saved.b)
+				return MAX_ITR;
 			
-			for (int x = 0; x < width; x += 8) // x axis of the image
-			{			
-				_xf = _mm256_setr_ps((float) x + 7, (float) x + 6, (float) x + 5, (float) x + 4,
-				(float) x + 3, (float) x + 2, (float) x + 1, (float) x);
-
-				// int index = y * width + x;			
-				int index0 = yw + x; // y * width + x
-				int index1 = yw + x + 1; // y * width + (x + 1)
-				int index2 = yw + x + 2; // y * width + (x + 2)
-				int index3 = yw + x + 3; // y * width + (x + 3)		
-				int index4 = yw + x + 4;
-				int index5 = yw + x + 5;
-				int index6 = yw + x + 6;
-				int index7 = yw + x + 7;
-
-				// int itr = 0;	
-				_itr = _mm256_set1_epi32(0); // initialize iteration counter for each pixel
-
-				// float zr = 0, zi = 0, cr = 0, ci = 0; [ Complex z, c ]				
-				_zr = _mm256_set1_ps(0);
-				_zi = _mm256_set1_ps(0);
-				_cr = _mm256_set1_ps(0);
-				_ci = _mm256_set1_ps(0);
+			if (++period == periodLength)
+			{
+				period = 0;
+				periodLength <<= 1;
+				saved = z;
+			}
+		}
+	}
+	
+	if (modulus)
+		*modulus = z.real() * z.real() + z.imaginary() * z.imaginary();
+	return itr;
+}
 
-				// getMappedScaleX(const int &x, const int &xMax)
+// renders count pixels of row y, starting at column x0 of a width x height frame, into span
+typedef void (*SpanKernel)(Color3f *, int, int, int, const int &, const int &);
 
-				// cr = (x * invW) - 2.5;			
-				_cr = _mm256_fmadd_ps(_xf, _invw, _const2p5neg);
+// Same as a SpanKernel, but stores the iteration count of every pixel into itrSpan instead of its color, and the
+// fractional part of its smooth iteration count into fracSpan unless that is null. The SIMD kernels mask the lanes
+// past the end of the span, so any count can be given and nothing past it is written.
+typedef void (*CountKernel)(uint32_t *, float *, int, int, int, const int &, const int &);
 
+// stores the iteration counts of count arbitrary points (cr, ci)
+typedef void (*SampleKernel)(uint32_t *, const float *, const float *, int);
 
-				// getMappedScaleY(const int &y, const int &yMax)
+const int SPAN_CHUNK = 256; // pixels counted at a time by the span kernels built on the count kernels
 
-				// ci = (y * invH) - 1;			
-				_ci = _mm256_fmadd_ps(_yf, _invh, _const1neg);
+// The smooth iteration count n + 1 - log2(log2 |Z_n|) grows continuously across the escape radius, unlike n
+// itself. Returns its fractional part relative to n, given |Z_n|^2 of the escaped Z_n. For Z^d + C the logarithm
+// of the outer log is taken to base d instead.
+inline float getSmoothFraction(uint32_t itr, double modulus, int power = 2)
+{
+	if (itr >= MAX_ITR)
+		return 0;
+	
+	float fraction = 1 - std::log2(0.5 * std::log2(modulus)) / std::log2(power);
+	return std::min(std::max(fraction, 0.0f), 1.0f);
+}
 
+// Colors a span with a count kernel, a chunk at a time so that the counts never leave the L1 cache. A streamed span
+// is written with non-temporal stores from a buffer on the stack, which skip reading the cache lines of the frame
+// buffer in first. Only the renderers that fill a whole frame that nothing reads before it is saved stream it; the
+// tiles, passes and rows that are read back right away would then have to come from memory instead of the cache.
+template <CountKernel countSpan, bool isStreamed>
+void drawSpanCounted(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	uint32_t itr[SPAN_CHUNK];
+	Color3f colors[SPAN_CHUNK];
+	
+	for (int i = 0; i < count; i += SPAN_CHUNK)
+	{
+		int n = std::min(SPAN_CHUNK, count - i);
+		countSpan(itr, nullptr, x0 + i, y, n, width, height);
+		
+		Color3f *dst = isStreamed ? colors : span + i;
+		for (int k = 0; k < n; k++)
+		{
+			if (itr[k] < MAX_ITR)
+				dst[k] = BLACK;
+			else
+				dst[k] = CYAN;
+		}
+		
+		if (isStreamed)
+			streamStore(span + i, colors, n * sizeof(Color3f));
+	}
+	
+	if (isStreamed)
+		_mm_sfence();
+}
 
-				///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+void countSpan(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	for (int i = 0; i < count; i++) // x axis of the span
+	{
+		Complex c;
+		c.a = getMappedScaleX((float)(x0 + i), width);
+		c.b = getMappedScaleY((float)y, height);
+		float modulus = 0;
+		itrSpan[i] = getIterations(c, &modulus);
+		if (fracSpan)
+			fracSpan[i] = getSmoothFraction(itrSpan[i], modulus);
+	}
+}
 
-			loop: // while (...)
+template <bool isStreamed>
+void drawSpan(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	drawSpanCounted<countSpan, isStreamed>(span, x0, y, count, width, height);
+}
 
-				_zr2 = _mm256_mul_ps(_zr, _zr); // zr * zr
-				_zi2 = _mm256_mul_ps(_zi, _zi); // zi * zi
-				_mod = _mm256_add_ps(_zr2, _zi2); // zr * zr + zi * zi			
+void countSamples(uint32_t *itr, const float *cr, const float *ci, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		Complex c;
+		c.a = cr[i];
+		c.b = ci[i];
+		itr[i] = getIterations(c);
+	}
+}
 
-				_masknumitr = _mm256_cmpgt_epi32(_constmaxitr, _itr); // MAX_ITR > itr	
-				_maskwhile = _mm256_cmp_ps(_mod, _const4, _CMP_LT_OQ); // zr * zr + zi * zi <= 4.0
-				_maskwhile = _mm256_and_ps(_maskwhile, _mm256_castsi256_ps(_masknumitr)); // (zr * zr + zi * zi <= 4.0 && itr < MAX_ITR)
+// same as getIterations() but in double precision, for zooms the single precision kernels cannot resolve
+uint32_t getIterationsDouble(double cr, double ci, double *modulus = nullptr)
+{
+	if (interiorChecks && isInCardioidOrBulb(cr, ci))
+		return MAX_ITR;
+	
+	uint32_t itr = 0, period = 0, periodLength = 1;
+	double zr = 0, zi = 0, savedR = 0, savedI = 0;
+	while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR)
+	{
+		double a = zr;
+		zr = zr * zr - zi * zi + cr;
+		zi = 2 * a * zi + ci;
+		itr++;
+		
+		if (interiorChecks)
+		{
+			if (zr == savedR && zi == savedI)
+				return MAX_ITR;
+			
+			if (++period == periodLength)
+			{
+				period = 0;
+				periodLength <<= 1;
+				savedR = zr;
+				savedI = zi;
+			}
+		}
+	}
+	
+	if (modulus)
+		*modulus = zr * zr + zi * zi;
+	return itr;
+}
+
+void countSpanDouble(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	double invW = view.getWidth() / width, invH = view.getHeight() / height;
+	double minX = view.getMinX(), minY = view.getMinY();
+	double ci = y * invH + minY;
+	
+	for (int i = 0; i < count; i++) // x axis of the span
+	{
+		double modulus = 0;
+		itrSpan[i] = getIterationsDouble((x0 + i) * invW + minX, ci, &modulus);
+		if (fracSpan)
+			fracSpan[i] = getSmoothFraction(itrSpan[i], modulus);
+	}
+}
+
+template <bool isStreamed>
+void drawSpanDouble(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	drawSpanCounted<countSpanDouble, isStreamed>(span, x0, y, count, width, height);
+}
+
+/*======================== PERTURBATION THEORY ========================*/
+
+// Beyond a zoom of about 1e13 even doubles cannot tell neighbouring pixels apart. Perturbation theory gets around
+// this by iterating a single reference orbit Z_n at the center of the view in higher precision, and then only
+// tracking the tiny difference d_n = z_n - Z_n of every pixel in double precision:
+//
+//		d_n+1 = 2 * Z_n * d_n + d_n^2 + dc [ where dc = c - C is the offset of the pixel from the center ]
+//
+// The deltas stay small relative to themselves, so a double is enough no matter how deep the zoom is. When the
+// orbit of a pixel gets closer to zero than its delta (or the reference orbit runs out), the delta is rebased onto
+// the start of the reference orbit, which avoids the glitches plain perturbation suffers from.
+
+std::vector<double> refOrbitReal; // reference orbit, rounded to double after each iteration in double-double
+std::vector<double> refOrbitImaginary;
+
+// computes the reference orbit at the center of the view, must be called again whenever the view changes
+void computeReferenceOrbit()
+{
+	refOrbitReal.clear();
+	refOrbitImaginary.clear();
+	
+	DoubleDouble zr, zi, cr = view.centerX, ci = view.centerY;
+	for (uint32_t n = 0; n <= MAX_ITR; n++)
+	{
+		refOrbitReal.push_back(zr.toDouble());
+		refOrbitImaginary.push_back(zi.toDouble());
+		
+		if (zr.toDouble() * zr.toDouble() + zi.toDouble() * zi.toDouble() > 2 * 2)
+			break;
+		
+		DoubleDouble a = zr;
+		zr = zr * zr - zi * zi + cr;
+		zi = DoubleDouble(2) * a * zi + ci;
+	}
+}
+
+// iterates the pixel at offset (dcr, dci) from the center of the view against the reference orbit
+uint32_t getIterationsPerturbation(double dcr, double dci, double *modulus = nullptr)
+{
+	const size_t refLength = refOrbitReal.size();
+	const double *refR = refOrbitReal.data(), *refI = refOrbitImaginary.data();
+	
+	uint32_t itr = 0;
+	size_t m = 0; // position along the reference orbit
+	double dr = 0, di = 0;
+	
+	while (itr < MAX_ITR)
+	{
+		double zr = refR[m] + dr, zi = refI[m] + di; // full value of z_n
+		double mod = zr * zr + zi * zi;
+		if (mod > 2 * 2)
+		{
+			if (modulus)
+				*modulus = mod;
+			break;
+		}
+		
+		// rebase onto the start of the reference orbit
+		if (m > 0 && (mod < dr * dr + di * di || m == refLength - 1))
+		{
+			dr = zr;
+			di = zi;
+			m = 0;
+		}
+		
+		// d = (2 * Z + d) * d + dc
+		double tr = 2 * refR[m] + dr, ti = 2 * refI[m] + di;
+		double a = dr;
+		dr = tr * dr - ti * di + dcr;
+		di = tr * di + ti * a + dci;
+		m++;
+		itr++;
+	}
+	return itr;
+}
+
+void countSpanPerturbation(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	double invW = view.getWidth() / width, invH = view.getHeight() / height;
+	double dci = (y - 0.5 * height) * invH;
+	
+	for (int i = 0; i < count; i++) // x axis of the span
+	{
+		double modulus = 0;
+		itrSpan[i] = getIterationsPerturbation((x0 + i - 0.5 * width) * invW, dci, &modulus);
+		if (fracSpan)
+			fracSpan[i] = getSmoothFraction(itrSpan[i], modulus);
+	}
+}
+
+template <bool isStreamed>
+void drawSpanPerturbation(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	drawSpanCounted<countSpanPerturbation, isStreamed>(span, x0, y, count, width, height);
+}
+
+/*=====================================================================*/
+
+// renders the frame one row at a time with the given span kernel
+void drawMandelbrotOMPSpans(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads, SpanKernel drawSpan, const RowCallback &onRowDone)
+{
+#pragma omp parallel for num_threads(nThreads) shared(frameBuffer) schedule(dynamic, 1)
+	for (int y = 0; y < height; y++) // y axis of the image	
+	{
+		drawSpan(frameBuffer + y * width, 0, y, width, width, height);
+		
+		if (onRowDone)
+			onRowDone(y);
+	}
+}
+
+/********************************************INTRINSICS BEGIN*****************************************/
+
+/////////////////////////////////////////////// FRACTAL ENGINE BEGIN /////////////////////////////////////////////
+
+// The single precision SIMD kernels render every fractal, the Mandelbrot set included, with a single generic
+// escape-time loop instead of a hand written kernel each. The loop is written once against a small set of vector
+// operations, and every instruction set provides them in a struct of its own (ScalarOps, SSEOps, AVXOps and
+// AVX512Ops). What sets the fractals apart is a formula policy, which picks the starting Z and the C of a point and
+// takes one step of the iteration. The kernels below instantiate the loop for every pair of the two inside a
+// function carrying the target attribute of the instruction set, so the operations are inlined into plain SIMD code.
+// The scalar Mandelbrot kernel stays separate, as the reference --verify checks the others against, and so do the
+// double precision kernels.
+
+// single lane fallback, used by the scalar renderers
+struct ScalarOps
+{
+	static constexpr int LANES = 1;
+	typedef float F; // float lanes
+	typedef uint32_t I; // iteration counter lanes
+	typedef bool M; // lane mask
+	
+	static inline F set1(float a) { return a; }
+	static inline F ramp(float a) { return a; }
+	static inline F add(F a, F b) { return a + b; }
+	static inline F sub(F a, F b) { return a - b; }
+	static inline F mul(F a, F b) { return a * b; }
+	static inline F fmadd(F a, F b, F c) { return a * b + c; }
+	static inline F abs(F a) { return std::fabs(a); }
+	static inline F blend(F a, F b, M m) { return m ? b : a; }
+	static inline M cmple(F a, F b) { return a <= b; }
+	static inline M cmpeq(F a, F b) { return a == b; }
+	static inline M andm(M a, M b) { return a && b; }
+	static inline M orm(M a, M b) { return a || b; }
+	static inline bool any(M m) { return m; }
+	static inline M tail(int lanes) { return lanes > 0; }
+	
+	static inline I iset1(uint32_t a) { return a; }
+	static inline M cmplt(I a, I b) { return a < b; }
+	static inline I increment(I a, M m) { return a + m; }
+	static inline I iblend(I a, I b, M m) { return m ? b : a; }
+	
+	static inline F load(const float *p, M, float) { return *p; }
+	static inline void store(uint32_t *p, I a, M) { *p = a; }
+	static inline void store(float *p, F a) { *p = a; }
+};
+
+struct SSEOps
+{
+	static constexpr int LANES = 4;
+	typedef __m128 F;
+	typedef __m128i I;
+	typedef __m128 M;
+	
+	__attribute__((target("sse4.1"))) static inline F set1(float a) { return _mm_set1_ps(a); }
+	__attribute__((target("sse4.1"))) static inline F ramp(float a) { return _mm_setr_ps(a, a + 1, a + 2, a + 3); }
+	__attribute__((target("sse4.1"))) static inline F add(F a, F b) { return _mm_add_ps(a, b); }
+	__attribute__((target("sse4.1"))) static inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+	__attribute__((target("sse4.1"))) static inline F mul(F a, F b) { return _mm_mul_ps(a, b); }
+	__attribute__((target("sse4.1"))) static inline F fmadd(F a, F b, F c) { return _mm_add_ps(_mm_mul_ps(a, b), c); } // no FMA in SSE
+	__attribute__((target("sse4.1"))) static inline F abs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	__attribute__((target("sse4.1"))) static inline F blend(F a, F b, M m) { return _mm_blendv_ps(a, b, m); }
+	__attribute__((target("sse4.1"))) static inline M cmple(F a, F b) { return _mm_cmple_ps(a, b); }
+	__attribute__((target("sse4.1"))) static inline M cmpeq(F a, F b) { return _mm_cmpeq_ps(a, b); }
+	__attribute__((target("sse4.1"))) static inline M andm(M a, M b) { return _mm_and_ps(a, b); }
+	__attribute__((target("sse4.1"))) static inline M orm(M a, M b) { return _mm_or_ps(a, b); }
+	__attribute__((target("sse4.1"))) static inline bool any(M m) { return _mm_movemask_ps(m) != 0; }
+	__attribute__((target("sse4.1"))) static inline M tail(int lanes) { return _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(lanes), _mm_setr_epi32(0, 1, 2, 3))); }
+	
+	__attribute__((target("sse4.1"))) static inline I iset1(uint32_t a) { return _mm_set1_epi32(a); }
+	__attribute__((target("sse4.1"))) static inline M cmplt(I a, I b) { return _mm_castsi128_ps(_mm_cmplt_epi32(a, b)); }
+	__attribute__((target("sse4.1"))) static inline I increment(I a, M m) { return _mm_sub_epi32(a, _mm_castps_si128(m)); } // true lanes are -1
+	__attribute__((target("sse4.1"))) static inline I iblend(I a, I b, M m) { return _mm_blendv_epi8(a, b, _mm_castps_si128(m)); }
+	
+	// SSE has no masked loads and stores that are not also non-temporal
+	__attribute__((target("sse4.1"))) static inline F load(const float *p, M m, float fill)
+	{
+		if (_mm_movemask_ps(m) == 0xF)
+			return _mm_loadu_ps(p);
+		
+		float lanes[4] = { fill, fill, fill, fill };
+		for (int k = 0; k < 4 && (_mm_movemask_ps(m) >> k & 1); k++)
+			lanes[k] = p[k];
+		return _mm_loadu_ps(lanes);
+	}
+	
+	__attribute__((target("sse4.1"))) static inline void store(uint32_t *p, I a, M m)
+	{
+		if (_mm_movemask_ps(m) == 0xF)
+		{
+			_mm_storeu_si128((__m128i *)p, a);
+			return;
+		}
+		
+		uint32_t lanes[4];
+		_mm_storeu_si128((__m128i *)lanes, a);
+		for (int k = 0; k < 4 && (_mm_movemask_ps(m) >> k & 1); k++)
+			p[k] = lanes[k];
+	}
+	
+	__attribute__((target("sse4.1"))) static inline void store(float *p, F a) { _mm_storeu_ps(p, a); }
+};
+
+struct AVXOps
+{
+	static constexpr int LANES = 8;
+	typedef __m256 F;
+	typedef __m256i I;
+	typedef __m256 M;
+	
+	__attribute__((target("avx2,fma"))) static inline F set1(float a) { return _mm256_set1_ps(a); }
+	__attribute__((target("avx2,fma"))) static inline F ramp(float a) { return _mm256_add_ps(_mm256_set1_ps(a), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)); }
+	__attribute__((target("avx2,fma"))) static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+	__attribute__((target("avx2,fma"))) static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+	__attribute__((target("avx2,fma"))) static inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+	__attribute__((target("avx2,fma"))) static inline F fmadd(F a, F b, F c) { return _mm256_fmadd_ps(a, b, c); }
+	__attribute__((target("avx2,fma"))) static inline F abs(F a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+	__attribute__((target("avx2,fma"))) static inline F blend(F a, F b, M m) { return _mm256_blendv_ps(a, b, m); }
+	__attribute__((target("avx2,fma"))) static inline M cmple(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	__attribute__((target("avx2,fma"))) static inline M cmpeq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	__attribute__((target("avx2,fma"))) static inline M andm(M a, M b) { return _mm256_and_ps(a, b); }
+	__attribute__((target("avx2,fma"))) static inline M orm(M a, M b) { return _mm256_or_ps(a, b); }
+	__attribute__((target("avx2,fma"))) static inline bool any(M m) { return _mm256_movemask_ps(m) != 0; }
+	__attribute__((target("avx2,fma"))) static inline M tail(int lanes) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))); }
+	
+	__attribute__((target("avx2,fma"))) static inline I iset1(uint32_t a) { return _mm256_set1_epi32(a); }
+	__attribute__((target("avx2,fma"))) static inline M cmplt(I a, I b) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a)); }
+	__attribute__((target("avx2,fma"))) static inline I increment(I a, M m) { return _mm256_sub_epi32(a, _mm256_castps_si256(m)); } // true lanes are -1
+	__attribute__((target("avx2,fma"))) static inline I iblend(I a, I b, M m) { return _mm256_blendv_epi8(a, b, _mm256_castps_si256(m)); }
+	
+	__attribute__((target("avx2,fma"))) static inline F load(const float *p, M m, float fill) { return _mm256_blendv_ps(_mm256_set1_ps(fill), _mm256_maskload_ps(p, _mm256_castps_si256(m)), m); }
+	__attribute__((target("avx2,fma"))) static inline void store(uint32_t *p, I a, M m) { _mm256_maskstore_epi32((int *)p, _mm256_castps_si256(m), a); }
+	__attribute__((target("avx2,fma"))) static inline void store(float *p, F a) { _mm256_storeu_ps(p, a); }
+};
+
+struct AVX512Ops
+{
+	static constexpr int LANES = 16;
+	typedef __m512 F;
+	typedef __m512i I;
+	typedef __mmask16 M;
+	
+	__attribute__((target("avx512f,avx2,fma"))) static inline F set1(float a) { return _mm512_set1_ps(a); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline F ramp(float a) { return _mm512_add_ps(_mm512_set1_ps(a), _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline F add(F a, F b) { return _mm512_add_ps(a, b); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline F fmadd(F a, F b, F c) { return _mm512_fmadd_ps(a, b, c); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline F abs(F a) { return _mm512_abs_ps(a); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline F blend(F a, F b, M m) { return _mm512_mask_blend_ps(m, a, b); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline M cmple(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline M cmpeq(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline M andm(M a, M b) { return a & b; }
+	__attribute__((target("avx512f,avx2,fma"))) static inline M orm(M a, M b) { return a | b; }
+	__attribute__((target("avx512f,avx2,fma"))) static inline bool any(M m) { return m != 0; }
+	__attribute__((target("avx512f,avx2,fma"))) static inline M tail(int lanes) { return (lanes >= 16) ? 0xFFFF : (1 << lanes) - 1; }
+	
+	__attribute__((target("avx512f,avx2,fma"))) static inline I iset1(uint32_t a) { return _mm512_set1_epi32(a); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline M cmplt(I a, I b) { return _mm512_cmplt_epi32_mask(a, b); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline I increment(I a, M m) { return _mm512_mask_add_epi32(a, m, a, _mm512_set1_epi32(1)); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline I iblend(I a, I b, M m) { return _mm512_mask_blend_epi32(m, a, b); }
+	
+	__attribute__((target("avx512f,avx2,fma"))) static inline F load(const float *p, M m, float fill) { return _mm512_mask_loadu_ps(_mm512_set1_ps(fill), m, p); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline void store(uint32_t *p, I a, M m) { _mm512_mask_storeu_epi32(p, m, a); }
+	__attribute__((target("avx512f,avx2,fma"))) static inline void store(float *p, F a) { _mm512_storeu_ps(p, a); }
+};
+
+// The generic code below is compiled for the baseline architecture and passes vectors around by value, which GCC
+// warns about. It is always inlined into the kernels at the end of this section, so no vector ever crosses a call.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// The formula policies. start() sets up Z_0 and C of the point P, and step() computes Z_n+1 from Z_n, given the
+// squares of its parts that the loop has already computed for the escape test. With the interior checks enabled,
+// skipInterior() sets the iteration count of the lanes whose C is known to lie inside the set to MAX_ITR up front.
+
+// for the fractals without a closed form for any part of their interior
+struct NoInterior
+{
+	template <class V>
+	__attribute__((always_inline)) static inline void skipInterior(const typename V::F &, const typename V::F &, typename V::I &)
+	{
+	}
+};
+
+// Z_n+1 = Z_n^2 + C, with Z_0 = 0 and C = P
+struct MandelbrotFormula
+{
+	static inline int getPower() { return 2; }
+	
+	// the main cardioid and the period-2 bulb, see isInCardioidOrBulb()
+	template <class V>
+	__attribute__((always_inline)) static inline void skipInterior(const typename V::F &cr, const typename V::F &ci, typename V::I &itr)
+	{
+		typedef typename V::F F;
+		
+		const F _quarter = V::set1(0.25), _one = V::set1(1.0), _sixteenth = V::set1(0.0625);
+		F _ci2 = V::mul(ci, ci);
+		F _xq = V::sub(cr, _quarter);
+		F _q = V::fmadd(_xq, _xq, _ci2);
+		typename V::M _cardioid = V::cmple(V::mul(_q, V::add(_q, _xq)), V::mul(_quarter, _ci2));
+		
+		F _xb = V::add(cr, _one);
+		typename V::M _bulb = V::cmple(V::fmadd(_xb, _xb, _ci2), _sixteenth);
+		
+		itr = V::iblend(itr, V::iset1(MAX_ITR), V::orm(_cardioid, _bulb));
+	}
+	
+	template <class V>
+	__attribute__((always_inline)) static inline void start(const typename V::F &pr, const typename V::F &pi, typename V::F &zr,
+															 typename V::F &zi, typename V::F &cr, typename V::F &ci)
+	{
+		zr = V::set1(0);
+		zi = V::set1(0);
+		cr = pr;
+		ci = pi;
+	}
+	
+	template <class V>
+	__attribute__((always_inline)) static inline void step(typename V::F &zr, typename V::F &zi, const typename V::F &zr2,
+															const typename V::F &zi2, const typename V::F &cr, const typename V::F &ci)
+	{
+		typename V::F zrzi = V::mul(zr, zi);
+		zr = V::add(V::sub(zr2, zi2), cr);
+		zi = V::fmadd(zrzi, V::set1(2), ci);
+	}
+};
+
+// Z_n+1 = Z_n^2 + C, with Z_0 = P and a fixed C
+struct JuliaFormula : public NoInterior
+{
+	static inline int getPower() { return 2; }
+	
+	template <class V>
+	__attribute__((always_inline)) static inline void start(const typename V::F &pr, const typename V::F &pi, typename V::F &zr,
+															 typename V::F &zi, typename V::F &cr, typename V::F &ci)
+	{
+		zr = pr;
+		zi = pi;
+		cr = V::set1(fractal.juliaR);
+		ci = V::set1(fractal.juliaI);
+	}
+	
+	template <class V>
+	__attribute__((always_inline)) static inline void step(typename V::F &zr, typename V::F &zi, const typename V::F &zr2,
+															const typename V::F &zi2, const typename V::F &cr, const typename V::F &ci)
+	{
+		typename V::F zrzi = V::mul(zr, zi);
+		zr = V::add(V::sub(zr2, zi2), cr);
+		zi = V::fmadd(zrzi, V::set1(2), ci);
+	}
+};
+
+// Z_n+1 = (|Re(Z_n)| + |Im(Z_n)| i)^2 + C, with Z_0 = 0 and C = P
+struct BurningShipFormula : public NoInterior
+{
+	static inline int getPower() { return 2; }
+	
+	template <class V>
+	__attribute__((always_inline)) static inline void start(const typename V::F &pr, const typename V::F &pi, typename V::F &zr,
+															 typename V::F &zi, typename V::F &cr, typename V::F &ci)
+	{
+		zr = V::set1(0);
+		zi = V::set1(0);
+		cr = pr;
+		ci = pi;
+	}
+	
+	template <class V>
+	__attribute__((always_inline)) static inline void step(typename V::F &zr, typename V::F &zi, const typename V::F &zr2,
+															const typename V::F &zi2, const typename V::F &cr, const typename V::F &ci)
+	{
+		typename V::F zrzi = V::abs(V::mul(zr, zi));
+		zr = V::add(V::sub(zr2, zi2), cr);
+		zi = V::fmadd(zrzi, V::set1(2), ci);
+	}
+};
+
+// Z_n+1 = Z_n^d + C, with Z_0 = 0 and C = P, where Z^d is taken by repeated multiplication
+struct MultibrotFormula : public NoInterior
+{
+	static inline int getPower() { return fractal.power; }
+	
+	template <class V>
+	__attribute__((always_inline)) static inline void start(const typename V::F &pr, const typename V::F &pi, typename V::F &zr,
+															 typename V::F &zi, typename V::F &cr, typename V::F &ci)
+	{
+		zr = V::set1(0);
+		zi = V::set1(0);
+		cr = pr;
+		ci = pi;
+	}
+	
+	template <class V>
+	__attribute__((always_inline)) static inline void step(typename V::F &zr, typename V::F &zi, const typename V::F &zr2,
+															const typename V::F &zi2, const typename V::F &cr, const typename V::F &ci)
+	{
+		// Z^2 from the squares, then one multiplication by Z for every further power
+		typename V::F pr = V::sub(zr2, zi2), pi = V::mul(V::set1(2), V::mul(zr, zi));
+		for (int k = 2; k < fractal.power; k++)
+		{
+			typename V::F a = V::sub(V::mul(pr, zr), V::mul(pi, zi));
+			pi = V::add(V::mul(pr, zi), V::mul(pi, zr));
+			pr = a;
+		}
+		zr = V::add(pr, cr);
+		zi = V::add(pi, ci);
+	}
+};
+
+// Iterates the points P held in the lanes of (pr, pi) with the given formula and stores their iteration counts
+// into itr. If escmod is given, it receives |Z|^2 of every lane at the moment the lane escaped. Points are checked
+// for cycles the same way getIterations() does, which holds for any of the formulas.
+template <class V, class Formula>
+__attribute__((always_inline)) inline void iterateFractal(const typename V::F &pr, const typename V::F &pi, typename V::I &itr, typename V::F *escmod)
+{
+	typedef typename V::F F;
+	typedef typename V::M M;
+	
+	F _zr, _zi, _cr, _ci;
+	Formula::template start<V>(pr, pi, _zr, _zi, _cr, _ci);
+	
+	const F _const4 = V::set1(4.0);
+	const typename V::I _constmaxitr = V::iset1(MAX_ITR);
+	itr = V::iset1(0);
+	
+	// lanes known to be inside the set start out as finished
+	if (interiorChecks)
+		Formula::template skipInterior<V>(_cr, _ci, itr);
+	
+	// state for Brent's cycle detection, see getIterations()
+	uint32_t period = 0, periodLength = 1;
+	F _oldr = _zr, _oldi = _zi;
+	
+	// |z|^2 a lane escaped with, for the smooth iteration count
+	F _escmod = V::set1(0);
+	M _maskrunning = V::tail(V::LANES);
+	
+	///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+	
+loop: // while (...)
+	
+	F _zr2 = V::mul(_zr, _zr); // zr * zr
+	F _zi2 = V::mul(_zi, _zi); // zi * zi
+	F _mod = V::add(_zr2, _zi2); // zr * zr + zi * zi
+	M _maskwhile = V::andm(V::cmple(_mod, _const4), V::cmplt(itr, _constmaxitr)); // (zr * zr + zi * zi <= 4.0 && itr < MAX_ITR)
+	
+	// lanes that were still running keep updating it, so it holds the escaped value once they stop
+	if (escmod)
+	{
+		_escmod = V::blend(_escmod, _mod, _maskrunning);
+		_maskrunning = _maskwhile;
+	}
+	
+	Formula::template step<V>(_zr, _zi, _zr2, _zi2, _cr, _ci);
+	
+	// itr++;
+	itr = V::increment(itr, _maskwhile);
+	
+	// lanes that came back to the value saved at the last power of two are periodic, hence finished
+	if (interiorChecks)
+	{
+		M _cycle = V::andm(V::andm(V::cmpeq(_zr, _oldr), V::cmpeq(_zi, _oldi)), _maskwhile);
+		itr = V::iblend(itr, _constmaxitr, _cycle);
+		
+		if (++period == periodLength)
+		{
+			period = 0;
+			periodLength <<= 1;
+			_oldr = _zr;
+			_oldi = _zi;
+		}
+	}
+	
+	// if (any one register satisfies while condition) goto loop;
+	if (V::any(_maskwhile))
+		goto loop;
+	
+	///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+	
+	if (escmod)
+		*escmod = _escmod;
+}
+
+// the CountKernel of the fractal engine, see countSpanAVX() for the layout of the lanes
+template <class V, class Formula>
+__attribute__((always_inline)) inline void countFractalSpan(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	typedef typename V::F F;
+	
+#ifdef STRICT_FP
+	const F _pi = V::set1(getMappedScaleY(y, height));
+#else
+	float invW = (1. / width) * view.getWidth(), invH = (1. / height) * view.getHeight();
+	float minX = view.getMinX(), minY = view.getMinY();
+	
+	const F _invw = V::set1(invW), _minx = V::set1(minX);
+	const F _pi = V::fmadd(V::set1((float)y), V::set1(invH), V::set1(minY));
+#endif
+	
+	for (int i = 0; i < count; i += V::LANES) // x axis of the span
+	{
+		// lanes past the end of the span escape right away and are not stored, |P| > 2 does so with any formula
+		const int lanes = std::min(count - i, V::LANES);
+		const typename V::M _tail = V::tail(lanes);
+#ifdef STRICT_FP
+		float crLanes[V::LANES];
+		getMappedScalesX(crLanes, x0 + i, lanes, width);
+		F _pr = V::load(crLanes, _tail, 4.0);
+#else
+		F _pr = V::blend(V::set1(4.0), V::fmadd(V::ramp((float)(x0 + i)), _invw, _minx), _tail);
+#endif
+		
+		typename V::I _itr;
+		F _escmod;
+		iterateFractal<V, Formula>(_pr, _pi, _itr, fracSpan ? &_escmod : nullptr);
+		V::store(itrSpan + i, _itr, _tail);
+		
+		if (fracSpan)
+		{
+			float modulus[V::LANES];
+			V::store(modulus, _escmod);
+			for (int k = 0; k < lanes; k++)
+				fracSpan[i + k] = getSmoothFraction(itrSpan[i + k], modulus[k], Formula::getPower());
+		}
+	}
+}
+
+// the SampleKernel of the fractal engine
+template <class V, class Formula>
+__attribute__((always_inline)) inline void countFractalSamples(uint32_t *itr, const float *cr, const float *ci, int count)
+{
+	for (int i = 0; i < count; i += V::LANES)
+	{
+		const typename V::M _tail = V::tail(count - i);
+		typename V::I _itr;
+		iterateFractal<V, Formula>(V::load(cr + i, _tail, 4.0), V::load(ci + i, _tail, 0), _itr, nullptr);
+		V::store(itr + i, _itr, _tail);
+	}
+}
+
+// instantiates the kernels of an instruction set for the current fractal
+template <class V>
+__attribute__((always_inline)) inline void countFractalSpan(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	switch (fractal.type)
+	{
+		case (FractalType::Mandelbrot):
+			countFractalSpan<V, MandelbrotFormula>(itrSpan, fracSpan, x0, y, count, width, height);
+			break;
+			
+		case (FractalType::Julia):
+			countFractalSpan<V, JuliaFormula>(itrSpan, fracSpan, x0, y, count, width, height);
+			break;
+			
+		case (FractalType::BurningShip):
+			countFractalSpan<V, BurningShipFormula>(itrSpan, fracSpan, x0, y, count, width, height);
+			break;
+			
+		default:
+			countFractalSpan<V, MultibrotFormula>(itrSpan, fracSpan, x0, y, count, width, height);
+	}
+}
+
+template <class V>
+__attribute__((always_inline)) inline void countFractalSamples(uint32_t *itr, const float *cr, const float *ci, int count)
+{
+	switch (fractal.type)
+	{
+		case (FractalType::Mandelbrot):
+			countFractalSamples<V, MandelbrotFormula>(itr, cr, ci, count);
+			break;
+			
+		case (FractalType::Julia):
+			countFractalSamples<V, JuliaFormula>(itr, cr, ci, count);
+			break;
+			
+		case (FractalType::BurningShip):
+			countFractalSamples<V, BurningShipFormula>(itr, cr, ci, count);
+			break;
+			
+		default:
+			countFractalSamples<V, MultibrotFormula>(itr, cr, ci, count);
+	}
+}
+
+uint32_t getFractalIterations(const Complex &c, float *modulus)
+{
+	uint32_t itr;
+	switch (fractal.type)
+	{
+		case (FractalType::Julia):
+			iterateFractal<ScalarOps, JuliaFormula>(c.a, c.b, itr, modulus);
+			break;
+			
+		case (FractalType::BurningShip):
+			iterateFractal<ScalarOps, BurningShipFormula>(c.a, c.b, itr, modulus);
+			break;
+			
+		default:
+			iterateFractal<ScalarOps, MultibrotFormula>(c.a, c.b, itr, modulus);
+	}
+	return itr;
+}
+
+#pragma GCC diagnostic pop
+
+// The kernels of every instruction set. Each one is compiled for its own instruction set, and the engine is inlined
+// into it for the fractal chosen at run time.
+
+__attribute__((target("sse4.1")))
+void countSpanSSE(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	countFractalSpan<SSEOps>(itrSpan, fracSpan, x0, y, count, width, height);
+}
+
+__attribute__((target("avx2,fma")))
+void countSpanAVX(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	countFractalSpan<AVXOps>(itrSpan, fracSpan, x0, y, count, width, height);
+}
+
+// same as countSpanAVX(), but for arbitrary points, 8 at a time
+__attribute__((target("avx2,fma")))
+void countSamplesAVX(uint32_t *itr, const float *cr, const float *ci, int count)
+{
+	countFractalSamples<AVXOps>(itr, cr, ci, count);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void countSpanAVX512(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	countFractalSpan<AVX512Ops>(itrSpan, fracSpan, x0, y, count, width, height);
+}
+
+// same as countSpanAVX512(), but for arbitrary points, 16 at a time
+__attribute__((target("avx512f,avx2,fma")))
+void countSamplesAVX512(uint32_t *itr, const float *cr, const float *ci, int count)
+{
+	countFractalSamples<AVX512Ops>(itr, cr, ci, count);
+}
+
+/////////////////////////////////////////////// FRACTAL ENGINE END ///////////////////////////////////////////////
+
+
+
+/////////////////////////////////////////////// SSE BEGIN /////////////////////////////////////////////
+
+template <bool isStreamed>
+void drawSpanSSE(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	drawSpanCounted<countSpanSSE, isStreamed>(span, x0, y, count, width, height);
+}
+
+// the frame is streamed unless its rows are handed on as soon as they are drawn
+void drawMandelbrotOMPSSE(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads, const RowCallback &onRowDone = nullptr)
+{
+	drawMandelbrotOMPSpans(frameBuffer, width, height, nThreads, onRowDone ? drawSpanSSE<false> : drawSpanSSE<true>, onRowDone);
+}
+
+/////////////////////////////////////////////// SSE END ///////////////////////////////////////////////
+
+
+
+/////////////////////////////////////////////// AVX BEGIN /////////////////////////////////////////////
+
+template <bool isStreamed>
+void drawSpanAVX(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	drawSpanCounted<countSpanAVX, isStreamed>(span, x0, y, count, width, height);
+}
+
+// the frame is streamed unless its rows are handed on as soon as they are drawn
+void drawMandelbrotOMPAVX(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads, const RowCallback &onRowDone = nullptr)
+{
+	drawMandelbrotOMPSpans(frameBuffer, width, height, nThreads, onRowDone ? drawSpanAVX<false> : drawSpanAVX<true>, onRowDone);
+}
+
+/////////////////////////////////////////////// AVX END ///////////////////////////////////////////////
+
+
+
+/////////////////////////////////////////////// AVX-512 BEGIN /////////////////////////////////////////////
+
+template <bool isStreamed>
+void drawSpanAVX512(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	drawSpanCounted<countSpanAVX512, isStreamed>(span, x0, y, count, width, height);
+}
+
+// the frame is streamed unless its rows are handed on as soon as they are drawn
+void drawMandelbrotOMPAVX512(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads, const RowCallback &onRowDone = nullptr)
+{
+	drawMandelbrotOMPSpans(frameBuffer, width, height, nThreads, onRowDone ? drawSpanAVX512<false> : drawSpanAVX512<true>, onRowDone);
+}
+
+/////////////////////////////////////////////// AVX-512 END /////////////////////////////////////////////
+
+//////////////////////////////////////////// DOUBLE PRECISION BEGIN //////////////////////////////////////////
+
+// The double precision kernels follow the same structure as their single precision counterparts, with half as
+// many lanes per register. The iteration counters are kept in double registers as well, which is exact for any
+// realistic iteration count and keeps all the masks in the same domain.
+
+// lanes of C that lie in the main cardioid or the period-2 bulb, see isInCardioidOrBulb()
+__attribute__((target("avx2,fma")))
+inline __m256d getInteriorMaskAVXDouble(__m256d _cr, __m256d _ci)
+{
+	__m256d _quarter = _mm256_set1_pd(0.25), _one = _mm256_set1_pd(1.0), _sixteenth = _mm256_set1_pd(0.0625);
+	
+	__m256d _ci2 = _mm256_mul_pd(_ci, _ci);
+	__m256d _xq = _mm256_sub_pd(_cr, _quarter);
+	__m256d _q = _mm256_fmadd_pd(_xq, _xq, _ci2);
+	__m256d _cardioid = _mm256_cmp_pd(_mm256_mul_pd(_q, _mm256_add_pd(_q, _xq)), _mm256_mul_pd(_quarter, _ci2), _CMP_LE_OQ);
+	
+	__m256d _xb = _mm256_add_pd(_cr, _one);
+	__m256d _bulb = _mm256_cmp_pd(_mm256_fmadd_pd(_xb, _xb, _ci2), _sixteenth, _CMP_LE_OQ);
+	
+	return _mm256_or_pd(_cardioid, _bulb);
+}
+
+__attribute__((target("avx2,fma")))
+void countSpanAVXDouble(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	double invW = view.getWidth() / width, invH = view.getHeight() / height;
+	
+	// 64-bit float registers
+	__m256d _zr, _zi, _cr, _ci, _zr2, _zi2, _mod, _itr, _maskwhile, _xf, _invw, _minx, _const1, _const2, _const4, _constmaxitr,
+		_oldr, _oldi, _cycle, _escmod, _maskrunning;
+	
+	// initialize floating point registers
+	_const1 = _mm256_set1_pd(1.0);
+	_const2 = _mm256_set1_pd(2.0);
+	_const4 = _mm256_set1_pd(4.0);
+	_constmaxitr = _mm256_set1_pd(MAX_ITR);
+	
+	_invw = _mm256_set1_pd(invW);
+	_minx = _mm256_set1_pd(view.getMinX());
+	
+	// ci = (y * invH) + minY;
+	_ci = _mm256_set1_pd(y * invH + view.getMinY());
+	
+	for (int i = 0; i < count; i += 4) // x axis of the span
+	{
+		int x = x0 + i;
+		
+		// lanes are in pixel order |0, 1, 2, 3|
+		_xf = _mm256_setr_pd(x, x + 1, x + 2, x + 3);
+		
+		// cr = (x * invW) + minX;
+#ifdef STRICT_FP
+		_cr = _mm256_add_pd(_mm256_mul_pd(_xf, _invw), _minx); // rounded twice, like countSpanDouble()
+#else
+		_cr = _mm256_fmadd_pd(_xf, _invw, _minx);
+#endif
+		
+		// lanes past the end of the span escape right away and are not stored
+		const int lanes = std::min(count - i, 4);
+		if (lanes < 4)
+			_cr = _mm256_blendv_pd(_mm256_set1_pd(4.0), _cr, _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(lanes), _mm256_setr_epi64x(0, 1, 2, 3))));
+		
+		_itr = _mm256_setzero_pd();
+		_zr = _mm256_setzero_pd();
+		_zi = _mm256_setzero_pd();
+		
+		// state for Brent's cycle detection, see getIterations()
+		uint32_t period = 0, periodLength = 1;
+		_oldr = _zr;
+		_oldi = _zi;
+		
+		// lanes in the main cardioid or the period-2 bulb start out as finished
+		if (interiorChecks)
+			_itr = _mm256_blendv_pd(_itr, _constmaxitr, getInteriorMaskAVXDouble(_cr, _ci));
+		
+		// |z|^2 a lane escaped with, for the smooth iteration count
+		_escmod = _mm256_setzero_pd();
+		_maskrunning = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+		
+		///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+		
+	loop: // while (...)
+		
+		_zr2 = _mm256_mul_pd(_zr, _zr); // zr * zr
+		_zi2 = _mm256_mul_pd(_zi, _zi); // zi * zi
+		_mod = _mm256_add_pd(_zr2, _zi2); // zr * zr + zi * zi
+		
+		_maskwhile = _mm256_and_pd(_mm256_cmp_pd(_mod, _const4, _CMP_LE_OQ), _mm256_cmp_pd(_itr, _constmaxitr, _CMP_LT_OQ));
+		
+		// lanes that were still running keep updating it, so it holds the escaped value once they stop
+		if (fracSpan)
+		{
+			_escmod = _mm256_blendv_pd(_escmod, _mod, _maskrunning);
+			_maskrunning = _maskwhile;
+		}
+		
+		// zi = 2 * zr * zi + ci; zr = zr * zr - zi * zi + cr;
+		_zi = _mm256_fmadd_pd(_mm256_mul_pd(_zr, _zi), _const2, _ci);
+		_zr = _mm256_add_pd(_mm256_sub_pd(_zr2, _zi2), _cr);
+		
+		// itr++;
+		_itr = _mm256_add_pd(_itr, _mm256_and_pd(_maskwhile, _const1));
+		
+		// lanes that came back to the value saved at the last power of two are periodic, hence finished
+		if (interiorChecks)
+		{
+			_cycle = _mm256_and_pd(_mm256_cmp_pd(_zr, _oldr, _CMP_EQ_OQ), _mm256_cmp_pd(_zi, _oldi, _CMP_EQ_OQ));
+			_cycle = _mm256_and_pd(_cycle, _maskwhile);
+			_itr = _mm256_blendv_pd(_itr, _constmaxitr, _cycle);
+			
+			if (++period == periodLength)
+			{
+				period = 0;
+				periodLength <<= 1;
+				_oldr = _zr;
+				_oldi = _zi;
+			}
+		}
+		
+		// if (any one register satisfies while condition) goto loop;
+		if (_mm256_movemask_pd(_maskwhile))
+			goto loop;
+		
+		///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+		
+		// itrSpan[index] = itr;
+		_mm_maskstore_epi32((int *)(itrSpan + i), _mm_cmpgt_epi32(_mm_set1_epi32(lanes), _mm_setr_epi32(0, 1, 2, 3)), _mm256_cvtpd_epi32(_itr));
+		
+		if (fracSpan)
+		{
+			double modulus[4];
+			_mm256_storeu_pd(modulus, _escmod);
+			for (int k = 0; k < lanes; k++)
+				fracSpan[i + k] = getSmoothFraction(itrSpan[i + k], modulus[k]);
+		}
+	}
+}
+
+template <bool isStreamed>
+void drawSpanAVXDouble(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	drawSpanCounted<countSpanAVXDouble, isStreamed>(span, x0, y, count, width, height);
+}
+
+// lanes of C that lie in the main cardioid or the period-2 bulb, see isInCardioidOrBulb()
+__attribute__((target("avx512f,avx2,fma")))
+inline __mmask8 getInteriorMaskAVX512Double(__m512d _cr, __m512d _ci)
+{
+	__m512d _quarter = _mm512_set1_pd(0.25), _one = _mm512_set1_pd(1.0), _sixteenth = _mm512_set1_pd(0.0625);
+	
+	__m512d _ci2 = _mm512_mul_pd(_ci, _ci);
+	__m512d _xq = _mm512_sub_pd(_cr, _quarter);
+	__m512d _q = _mm512_fmadd_pd(_xq, _xq, _ci2);
+	__mmask8 _cardioid = _mm512_cmp_pd_mask(_mm512_mul_pd(_q, _mm512_add_pd(_q, _xq)), _mm512_mul_pd(_quarter, _ci2), _CMP_LE_OQ);
+	
+	__m512d _xb = _mm512_add_pd(_cr, _one);
+	__mmask8 _bulb = _mm512_cmp_pd_mask(_mm512_fmadd_pd(_xb, _xb, _ci2), _sixteenth, _CMP_LE_OQ);
+	
+	return _cardioid | _bulb;
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void countSpanAVX512Double(uint32_t *itrSpan, float *fracSpan, int x0, int y, int count, const int &width, const int &height)
+{
+	double invW = view.getWidth() / width, invH = view.getHeight() / height;
+	
+	// 64-bit float registers
+	__m512d _zr, _zi, _cr, _ci, _zr2, _zi2, _mod, _itr, _xf, _invw, _minx, _const1, _const2, _const4, _constmaxitr,
+		_oldr, _oldi, _escmod;
+	
+	// initialize floating point registers
+	_const1 = _mm512_set1_pd(1.0);
+	_const2 = _mm512_set1_pd(2.0);
+	_const4 = _mm512_set1_pd(4.0);
+	_constmaxitr = _mm512_set1_pd(MAX_ITR);
+	
+	_invw = _mm512_set1_pd(invW);
+	_minx = _mm512_set1_pd(view.getMinX());
+	
+	// ci = (y * invH) + minY;
+	_ci = _mm512_set1_pd(y * invH + view.getMinY());
+	
+	for (int i = 0; i < count; i += 8) // x axis of the span
+	{
+		int x = x0 + i;
+		
+		// lanes are in pixel order |0, 1, 2, 3, 4, 5, 6, 7|
+		_xf = _mm512_setr_pd(x, x + 1, x + 2, x + 3, x + 4, x + 5, x + 6, x + 7);
+		
+		// cr = (x * invW) + minX;
+#ifdef STRICT_FP
+		_cr = _mm512_add_pd(_mm512_mul_pd(_xf, _invw), _minx); // rounded twice, like countSpanDouble()
+#else
+		_cr = _mm512_fmadd_pd(_xf, _invw, _minx);
+#endif
+		
+		// lanes past the end of the span escape right away and are not stored
+		const int lanes = std::min(count - i, 8);
+		_cr = _mm512_mask_blend_pd((1 << lanes) - 1, _mm512_set1_pd(4.0), _cr);
+		
+		_itr = _mm512_setzero_pd();
+		_zr = _mm512_setzero_pd();
+		_zi = _mm512_setzero_pd();
+		
+		// state for Brent's cycle detection, see getIterations()
+		uint32_t period = 0, periodLength = 1;
+		_oldr = _zr;
+		_oldi = _zi;
+		
+		// lanes in the main cardioid or the period-2 bulb start out as finished
+		if (interiorChecks)
+			_itr = _mm512_mask_mov_pd(_itr, getInteriorMaskAVX512Double(_cr, _ci), _constmaxitr);
+		
+		// |z|^2 a lane escaped with, for the smooth iteration count
+		_escmod = _mm512_setzero_pd();
+		__mmask8 _running = 0xFF;
+		
+		///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+		
+	loop: // while (...)
+		
+		_zr2 = _mm512_mul_pd(_zr, _zr); // zr * zr
+		_zi2 = _mm512_mul_pd(_zi, _zi); // zi * zi
+		_mod = _mm512_add_pd(_zr2, _zi2); // zr * zr + zi * zi
+		
+		__mmask8 _masknumitr = _mm512_cmp_pd_mask(_itr, _constmaxitr, _CMP_LT_OQ); // itr < MAX_ITR
+		__mmask8 _maskradius = _mm512_cmp_pd_mask(_mod, _const4, _CMP_LE_OQ); // zr * zr + zi * zi <= 4.0
+		__mmask8 _whileTrue = _maskradius & _masknumitr;
+		
+		// lanes that were still running keep updating it, so it holds the escaped value once they stop
+		if (fracSpan)
+		{
+			_escmod = _mm512_mask_mov_pd(_escmod, _running, _mod);
+			_running = _whileTrue;
+		}
+		
+		// zi = 2 * zr * zi + ci; zr = zr * zr - zi * zi + cr;
+		_zi = _mm512_fmadd_pd(_mm512_mul_pd(_zr, _zi), _const2, _ci);
+		_zr = _mm512_add_pd(_mm512_sub_pd(_zr2, _zi2), _cr);
+		
+		// itr++;
+		_itr = _mm512_mask_add_pd(_itr, _whileTrue, _itr, _const1);
+		
+		// lanes that came back to the value saved at the last power of two are periodic, hence finished
+		if (interiorChecks)
+		{
+			__mmask8 _cycle = _mm512_mask_cmp_pd_mask(_whileTrue, _zr, _oldr, _CMP_EQ_OQ) & _mm512_cmp_pd_mask(_zi, _oldi, _CMP_EQ_OQ);
+			_itr = _mm512_mask_mov_pd(_itr, _cycle, _constmaxitr);
+			
+			if (++period == periodLength)
+			{
+				period = 0;
+				periodLength <<= 1;
+				_oldr = _zr;
+				_oldi = _zi;
+			}
+		}
+		
+		// if (any one register satisfies while condition) goto loop;
+		if (_whileTrue)
+			goto loop;
+		
+		///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+		
+		// itrSpan[index] = itr; without AVX-512VL the 256-bit store is masked the AVX2 way
+		__m256i _tail = _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		_mm256_maskstore_epi32((int *)(itrSpan + i), _tail, _mm512_maskz_cvtpd_epi32(0xFF, _itr));
+		
+		if (fracSpan)
+		{
+			double modulus[8];
+			_mm512_storeu_pd(modulus, _escmod);
+			for (int k = 0; k < lanes; k++)
+				fracSpan[i + k] = getSmoothFraction(itrSpan[i + k], modulus[k]);
+		}
+	}
+}
+
+template <bool isStreamed>
+void drawSpanAVX512Double(Color3f *span, int x0, int y, int count, const int &width, const int &height)
+{
+	drawSpanCounted<countSpanAVX512Double, isStreamed>(span, x0, y, count, width, height);
+}
+
+//////////////////////////////////////////// DOUBLE PRECISION END ////////////////////////////////////////////
+
+/********************************************INTRINSICS END*******************************************/
+
+void drawMandelbrot(Color3f *frameBuffer, const int &width, const int &height, const RowCallback &onRowDone = nullptr)
+{
+	uint32_t index = 0;
+	for (int y = 0; y < height; y++) // y axis of the image	
+	{
+		for (int x = 0; x < width; x++) // x axis of the image
+		{
+			index = y * width + x;
+			Complex c;
+			c.a = getMappedScaleX((float)x, width);
+			c.b = getMappedScaleY((float)y, height);
+			uint32_t itr = getIterations(c);
+			if (itr < MAX_ITR)
+				frameBuffer[index] = BLACK;
+			else
+				frameBuffer[index] = CYAN;
+		}
+		
+		if (onRowDone)
+			onRowDone(y);
+	}
+}
+
+void drawMandelbrotOMP(Color3f* frameBuffer, const int &width, const int &height, uint32_t nThreads, const RowCallback &onRowDone = nullptr)
+{
+#pragma omp parallel num_threads(nThreads) shared(frameBuffer)
+	{
+#pragma omp for schedule(dynamic, 1) 
+		for (int y = 0; y < height; y++) // y axis of the image	
+		{
+			for (int x = 0; x < width; x++) // x axis of the image
+			{
+				uint32_t index = y * width + x;
+				Complex c;
+				c.a = getMappedScaleX((float)x, width);
+				c.b = getMappedScaleY((float)y, height);
+				uint32_t itr = getIterations(c);
+				if (itr < MAX_ITR)
+					frameBuffer[index] = BLACK;
+				else
+					frameBuffer[index] = CYAN;
+			}
+			
+			if (onRowDone)
+				onRowDone(y);
+		}
+	}
+}
+
+/*========================== NUMA PLACEMENT ==========================*/
+
+// A page of memory is placed on the NUMA node of the thread that first touches it. Constructing the frame buffer with
+// new Color3f[] touches every page from the main thread, so on a machine with several sockets the whole frame ends
+// up on one node and the render threads of the other sockets write to remote memory. The frame buffer is therefore
+// mapped untouched, and its pixels are constructed either by the threads that are going to render them or after
+// interleaving its pages over all the nodes. Touching pages from the right threads only helps if the threads stay
+// where they are, which is what pinThreads is for.
+
+enum struct Placement
+{
+	MainThread, // every page on the node of the main thread, as with new Color3f[]
+	FirstTouch, // every page on the node of the thread that renders it
+	Interleave  // the pages spread round-robin over all the nodes
+};
+
+bool pinThreads = false; // pins render thread i to the i-th logical processor the process may run on, while it renders
+
+const char* getPlacementName(Placement placement)
+{
+	switch (placement)
+	{
+	case Placement::MainThread:
+		return "main";
+	case Placement::FirstTouch:
+		return "first-touch";
+	case Placement::Interleave:
+		return "interleave";
+	}
+	
+	return "unknown";
+}
+
+// returns a bit for every NUMA node that is online, only node 0 if the kernel does not say
+unsigned long getNUMANodeMask()
+{
+	std::ifstream file("/sys/devices/system/node/online");
+	unsigned long nodeMask = 0;
+	for (std::string range; std::getline(file, range, ',');) // "0-1,4"
+	{
+		int first = 0, last = 0;
+		if (std::sscanf(range.c_str(), "%d-%d", &first, &last) == 1)
+			last = first;
+		for (int node = std::max(first, 0); node <= last && node < static_cast<int>(sizeof(nodeMask) * CHAR_BIT); node++)
+			nodeMask |= 1ul << node;
+	}
+	
+	return nodeMask ? nodeMask : 1;
+}
+
+int getNumNUMANodes()
+{
+	return __builtin_popcountl(getNUMANodeMask());
+}
+
+// returns the node of the logical processor the calling thread is running on, or -1 if unknown
+int getCurrentNode()
+{
+	unsigned cpu = 0, node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+		return -1;
+	
+	return node;
+}
+
+// Pins the calling thread to one of the logical processors the process was allowed to run on when first called,
+// in order of their numbers. Thread i of every renderer ends up on the same processor, so it finds the pages it
+// touched first on its own node.
+void pinThread(int threadIndex)
+{
+	static const std::vector<int> cpus = [] {
+		std::vector<int> allowed;
+		cpu_set_t set;
+		if (sched_getaffinity(getpid(), sizeof(set), &set) == 0)
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+				if (CPU_ISSET(cpu, &set))
+					allowed.push_back(cpu);
+		return allowed;
+	}();
+	
+	if (cpus.empty())
+		return;
+	
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpus[threadIndex % cpus.size()], &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Pins OpenMP thread i of a team of nThreads to the i-th logical processor for as long as it lives, if enabled, and
+// then lets every thread run where it was allowed to before. OpenMP keeps its threads from one parallel region to
+// the next, so the frame buffer can be first touched and rendered in between by the same threads on the same
+// processors, without leaving the main thread, which is OpenMP thread 0, pinned for the rest of the program.
+class PinnedThreads
+{
+public:
+	PinnedThreads(uint32_t nThreads, bool isEnabled) :
+		masks(isEnabled ? nThreads : 0)
+	{
+		if (masks.empty())
+			return;
+		
+#pragma omp parallel num_threads(nThreads)
+		{
+			cpu_set_t &mask = masks[omp_get_thread_num()];
+			pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask);
+			pinThread(omp_get_thread_num());
+		}
+	}
+	
+	~PinnedThreads()
+	{
+		restore();
+	}
+	
+	void restore()
+	{
+		if (masks.empty())
+			return;
+		
+#pragma omp parallel num_threads(masks.size())
+		{
+			const cpu_set_t &mask = masks[omp_get_thread_num()];
+			pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+		}
+		masks.clear();
+	}
+	
+private:
+	std::vector<cpu_set_t> masks; // the processors every thread was allowed on before
+};
+
+// Maps a frame buffer without touching it, places its pages and constructs its pixels. With first touch the rows
+// are constructed round-robin by nThreads OpenMP threads, which is how the dynamic schedule of the row renderers
+// hands them out for as long as the rows take about the same time. Given the tile size of drawMandelbrotMT(), thread
+// i constructs the tiles STL thread i starts out with instead. Only while the OpenMP threads are pinned, through
+// PinnedThreads, is OpenMP thread i on the same processor as STL thread i, and the rows stay with their thread no
+// matter how the dynamic schedule goes.
+// A huge page lands on a single node as a whole, so with first touch by rows only small pages are placed row by row.
+// Free with freeFrameBuffer().
+Color3f *allocateFrameBuffer(int width, int height, Placement placement, uint32_t nThreads, int tileSize = 0, PageSize pageSize = PageSize::Small)
+{
+	const size_t bufferSize = static_cast<size_t>(width) * height;
+	const PageSize requested = pageSize;
+	void *memory = allocateBuffer(bufferSize * sizeof(Color3f), pageSize);
+	if (!memory)
+	{
+		std::cerr << "Could not allocate the frame buffer! Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	if (pageSize != requested)
+		std::cerr << "No explicit huge pages are reserved, using transparent huge pages instead." << std::endl;
+	
+	Color3f *frameBuffer = static_cast<Color3f *>(memory);
+	
+	// the kernel drops the last bit of the mask, hence the one extra
+	unsigned long nodeMask = getNUMANodeMask();
+	if (placement == Placement::Interleave && getNumNUMANodes() > 1 &&
+		syscall(SYS_mbind, memory, bufferSize * sizeof(Color3f), MPOL_INTERLEAVE, &nodeMask, sizeof(nodeMask) * CHAR_BIT + 1, 0) != 0)
+		std::cerr << "Could not interleave the frame buffer over the NUMA nodes, leaving it to first touch." << std::endl;
+	
+	if (placement == Placement::MainThread)
+	{
+		for (size_t i = 0; i < bufferSize; i++)
+			new (frameBuffer + i) Color3f();
+		return frameBuffer;
+	}
+	
+	const int numThreads = nThreads;
+	const int tilesX = tileSize ? (width + tileSize - 1) / tileSize : 0;
+	const int numTiles = tileSize ? tilesX * ((height + tileSize - 1) / tileSize) : 0;
+	
+#pragma omp parallel num_threads(nThreads)
+	{
+		if (tileSize)
+		{
+			// one iteration per thread, so that iteration i goes to thread i
+#pragma omp for schedule(static, 1)
+			for (int i = 0; i < numThreads; i++)
+			{
+				for (int tile = i * numTiles / numThreads; tile < (i + 1) * numTiles / numThreads; tile++)
+				{
+					const int startX = (tile % tilesX) * tileSize, startY = (tile / tilesX) * tileSize;
+					const int endX = std::min(startX + tileSize, width), endY = std::min(startY + tileSize, height);
+					for (int y = startY; y < endY; y++)
+						for (int x = startX; x < endX; x++)
+							new (frameBuffer + static_cast<size_t>(y) * width + x) Color3f();
+				}
+			}
+		}
+		else
+		{
+#pragma omp for schedule(static, 1)
+			for (int y = 0; y < height; y++)
+				for (int x = 0; x < width; x++)
+					new (frameBuffer + static_cast<size_t>(y) * width + x) Color3f();
+		}
+	}
+	
+	return frameBuffer;
+}
+
+void freeFrameBuffer(Color3f *frameBuffer, int width, int height)
+{
+	freeBuffer(frameBuffer, static_cast<size_t>(width) * height * sizeof(Color3f));
+}
+
+// Returns the share of the pages of every row that are on another node than the one the row was finished on, or -1
+// if the kernel cannot say where the pages are. Rows finished on an unknown node (-1) are left out.
+double getRemoteShare(const Color3f *frameBuffer, int width, int height, const std::vector<int> &rowNodes)
+{
+	const size_t pageSize = sysconf(_SC_PAGESIZE), rowSize = static_cast<size_t>(width) * sizeof(Color3f);
+	const size_t numPages = (rowSize * height + pageSize - 1) / pageSize;
+	
+	// the frame buffer is page aligned, as it comes from mmap
+	std::vector<void *> pages(numPages);
+	for (size_t i = 0; i < numPages; i++)
+		pages[i] = const_cast<char *>(reinterpret_cast<const char *>(frameBuffer)) + i * pageSize;
+	
+	std::vector<int> pageNodes(numPages);
+	if (syscall(SYS_move_pages, 0, numPages, pages.data(), nullptr, pageNodes.data(), 0) != 0)
+		return -1;
+	
+	uint64_t numLocal = 0, numRemote = 0;
+	for (int y = 0; y < height; y++)
+	{
+		if (rowNodes[y] < 0)
+			continue;
+		
+		for (size_t page = y * rowSize / pageSize; page <= ((y + 1) * rowSize - 1) / pageSize; page++)
+		{
+			if (pageNodes[page] < 0) // not mapped
+				continue;
+			if (pageNodes[page] == rowNodes[y])
+				numLocal++;
+			else
+				numRemote++;
+		}
+	}
+	
+	return (numLocal + numRemote) ? static_cast<double>(numRemote) / (numLocal + numRemote) : -1;
+}
+
+/*====================== WORK-STEALING SCHEDULER =====================*/
+
+// The STL thread renderer used to give every thread one horizontal band of the frame, and the threads whose bands
+// cover the interior of the set kept working long after the others had finished. The frame is now cut into small
+// tiles instead. Every thread starts out with the tiles of its own band in a deque, which it works through from
+// the back, and once the deque is empty it steals tiles from the front of the other threads' deques.
+
+const int MT_TILE_SIZE = 32; // edge length of the square tiles handed out by the work-stealing scheduler
+
+// tiles of a thread, the owner takes them from the back and thieves from the front
+struct TileDeque
+{
+	std::mutex mutex;
+	std::deque<int> tiles;
+};
+
+struct ThreadStats
+{
+	double busyMSec = 0; // time spent rendering tiles
+	uint32_t numTiles = 0;
+	uint32_t numStolen = 0;
+};
+
+bool popTile(TileDeque &deque, int &tile)
+{
+	std::lock_guard<std::mutex> lock(deque.mutex);
+	if (deque.tiles.empty())
+		return false;
+	
+	tile = deque.tiles.back();
+	deque.tiles.pop_back();
+	return true;
+}
+
+bool stealTile(TileDeque &deque, int &tile)
+{
+	std::lock_guard<std::mutex> lock(deque.mutex);
+	if (deque.tiles.empty())
+		return false;
+	
+	tile = deque.tiles.front();
+	deque.tiles.pop_front();
+	return true;
+}
+
+// No tiles are added once the threads are running, so a thread is done when its own deque and all the others are empty.
+void drawMandelbrotThread(int threadIndex, int nThreads, int width, int height, TileDeque *deques, std::atomic<int> *bandTiles, bool allowStealing,
+						  Color3f *frameBuffer, const RowCallback &onRowDone, ThreadStats &stats)
+{
+	const int tilesX = (width + MT_TILE_SIZE - 1) / MT_TILE_SIZE;
+	int tile = 0;
+	
+	if (pinThreads)
+		pinThread(threadIndex);
+	
+	for (;;)
+	{
+		bool isStolen = false;
+		if (!popTile(deques[threadIndex], tile))
+		{
+			if (!allowStealing)
+				break;
+			
+			// visit the other threads in turn, starting with the next one
+			for (int i = 1; i < nThreads && !isStolen; i++)
+				isStolen = stealTile(deques[(threadIndex + i) % nThreads], tile);
+			
+			if (!isStolen)
+				break;
+		}
+		
+		auto start = std::chrono::high_resolution_clock::now();
+		
+		const int band = tile / tilesX;
+		const int startX = (tile % tilesX) * MT_TILE_SIZE, startY = band * MT_TILE_SIZE;
+		const int endX = std::min(startX + MT_TILE_SIZE, width), endY = std::min(startY + MT_TILE_SIZE, height);
+		
+		for (int y = startY; y < endY; y++) // y axis of the tile
+		{
+			for (int x = startX; x < endX; x++) // x axis of the tile
+			{
+				uint32_t index = y * width + x;
+				Complex c;
+				c.a = getMappedScaleX((float)x, width);
+				c.b = getMappedScaleY((float)y, height);
+				uint32_t itr = getIterations(c);
+				if (itr < MAX_ITR)
+					frameBuffer[index] = BLACK;
+				else
+					frameBuffer[index] = CYAN;
+			}
+		}
+		
+		auto stop = std::chrono::high_resolution_clock::now();
+		stats.busyMSec += std::chrono::duration<double, std::milli>(stop - start).count();
+		stats.numTiles++;
+		stats.numStolen += isStolen;
+		
+		// the rows of a band are complete once its last tile is done
+		if (onRowDone && bandTiles[band].fetch_sub(1) == 1)
+			for (int y = startY; y < endY; y++)
+				onRowDone(y);
+	}
+}
+
+// Renders the frame with STL threads over a work-stealing scheduler. Without stealing, every thread only renders
+// its own band, as the original static split did. Fills threadStats with the busy time of every thread if given.
+void drawMandelbrotMT(Color3f *frameBuffer, const int &width, const int &height, int nThreads, const RowCallback &onRowDone = nullptr,
+					  std::vector<ThreadStats> *threadStats = nullptr, bool allowStealing = true)
+{
+	const int tilesX = (width + MT_TILE_SIZE - 1) / MT_TILE_SIZE, tilesY = (height + MT_TILE_SIZE - 1) / MT_TILE_SIZE;
+	const int numTiles = tilesX * tilesY;
+	
+	// every thread starts out with a contiguous run of tiles, in other words a band of the frame
+	std::unique_ptr<TileDeque[]> deques(new TileDeque[nThreads]);
+	for (int i = 0; i < nThreads; ++i)
+		for (int tile = i * numTiles / nThreads; tile < (i + 1) * numTiles / nThreads; ++tile)
+			deques[i].tiles.push_back(tile);
+	
+	std::unique_ptr<std::atomic<int>[]> bandTiles(new std::atomic<int>[tilesY]);
+	for (int band = 0; band < tilesY; ++band)
+		bandTiles[band] = tilesX;
+	
+	std::vector<ThreadStats> stats(nThreads);
+	std::vector<std::thread> mandelThreads;
+	for (int i = 0; i < nThreads; ++i)
+		mandelThreads.emplace_back(drawMandelbrotThread, i, nThreads, width, height, deques.get(), bandTiles.get(), allowStealing,
+								   frameBuffer, std::cref(onRowDone), std::ref(stats[i]));
+	
+	for (int i = 0; i < nThreads; ++i)
+		mandelThreads[i].join();
+	
+	if (threadStats)
+		*threadStats = stats;
+}
+
+// prints how evenly the work was spread over the threads
+void printThreadStats(const std::vector<ThreadStats> &stats)
+{
+	double minMSec = stats[0].busyMSec, maxMSec = stats[0].busyMSec, totalMSec = 0;
+	uint32_t numStolen = 0;
+	for (const ThreadStats &s : stats)
+	{
+		minMSec = std::min(minMSec, s.busyMSec);
+		maxMSec = std::max(maxMSec, s.busyMSec);
+		totalMSec += s.busyMSec;
+		numStolen += s.numStolen;
+	}
+	
+	std::printf("Busy time per thread: min %.1f ms, mean %.1f ms, max %.1f ms (%u tiles stolen)\n",
+				minMSec, totalMSec / stats.size(), maxMSec, numStolen);
+}
+
+// Renders the default view with the STL threads, once with every thread on its own band and once with work
+// stealing, and prints the busy time of every thread along with the total time.
+void benchmarkWorkStealing(int width, int height)
+{
+	Color3f *frameBuffer = new Color3f[width * height];
+	const char *names[2] = { "Static bands", "Work stealing" };
+	
+	for (int stealing = 0; stealing < 2; ++stealing)
+	{
+		std::vector<ThreadStats> stats;
+		auto start = std::chrono::high_resolution_clock::now();
+		drawMandelbrotMT(frameBuffer, width, height, std::thread::hardware_concurrency(), nullptr, &stats, stealing);
+		auto stop = std::chrono::high_resolution_clock::now();
+		
+		std::printf("%s: %.1f ms\n", names[stealing], std::chrono::duration<double, std::milli>(stop - start).count());
+		for (size_t i = 0; i < stats.size(); ++i)
+			std::printf("  thread %2zu: %8.1f ms busy, %5u tiles, %5u stolen\n", i, stats[i].busyMSec, stats[i].numTiles, stats[i].numStolen);
+		printThreadStats(stats);
+	}
+	
+	delete[] frameBuffer;
+}
+
+/*======================= MARIANI-SILVER SUBDIVISION ====================*/
+
+// Since the Mandelbrot set is connected, a rectangle whose whole border has the same iteration count contains no
+// detail of the set, and its interior can simply be filled with that count. The Mariani-Silver algorithm starts
+// with the border of the frame, and keeps splitting every rectangle whose border is not uniform into four, until
+// the rectangles are small enough to be evaluated completely. The lines that split a rectangle are evaluated by
+// the parent before the four children are spawned as OpenMP tasks, so no pixel is evaluated twice. The rows of the
+// borders and split lines are contiguous spans of the frame and go through the count kernels, while the columns
+// are gathered into batches for the sample kernels, so that both fill the SIMD lanes.
+
+// Rectangles with a side of at most this many pixels are evaluated completely. Going down from 8 to 4 saves another
+// 12% of the evaluations on the default view, while going on to 2 saves only 3% more and gets more pixels wrong.
+const int SUBDIVISION_MIN_SIZE = 4;
+const int SUBDIVISION_TASK_SIZE = 32; // smaller rectangles are not worth spawning tasks for
+
+struct SubdivisionContext
+{
+	uint32_t *itrBuffer;
+	int width;
+	int height;
+	CountKernel countSpan;
+	SampleKernel countSamples; // null if the columns have to go through countSpan as well
+	std::atomic<uint64_t> numEvaluated;
+};
+
+// Evaluates the pixels of the rectangle x0, y0, x1, y1 (inclusive). Rectangles wider than tall are counted a row at
+// a time, the others are gathered into batches of points for the sample kernel. The points are mapped exactly like
+// the count kernels of the fractal engine map them, so a pixel comes out the same whichever way it is evaluated.
+void countRect(SubdivisionContext &ctx, int x0, int y0, int x1, int y1)
+{
+	uint32_t *itr = ctx.itrBuffer;
+	const int width = ctx.width;
+	const int rectWidth = x1 - x0 + 1, rectHeight = y1 - y0 + 1;
+	
+	if (rectWidth <= 0 || rectHeight <= 0)
+		return;
+	
+	if (rectWidth >= rectHeight || !ctx.countSamples)
+	{
+		for (int y = y0; y <= y1; y++)
+			ctx.countSpan(itr + static_cast<size_t>(y) * width + x0, nullptr, x0, y, rectWidth, ctx.width, ctx.height);
+		return;
+	}
+	
+#ifndef STRICT_FP
+	float invW = (1. / ctx.width) * view.getWidth(), invH = (1. / ctx.height) * view.getHeight();
+	float minX = view.getMinX(), minY = view.getMinY();
+#endif
+	
+	float cr[SPAN_CHUNK], ci[SPAN_CHUNK];
+	uint32_t counts[SPAN_CHUNK];
+	const int numPixels = rectWidth * rectHeight;
+	
+	for (int i = 0; i < numPixels; i += SPAN_CHUNK)
+	{
+		const int n = std::min(SPAN_CHUNK, numPixels - i);
+		for (int k = 0; k < n; k++)
+		{
+			const int x = x0 + (i + k) % rectWidth, y = y0 + (i + k) / rectWidth;
+#ifdef STRICT_FP
+			cr[k] = getMappedScaleX(x, ctx.width);
+			ci[k] = getMappedScaleY(y, ctx.height);
+#else
+			cr[k] = std::fma(static_cast<float>(x), invW, minX);
+			ci[k] = std::fma(static_cast<float>(y), invH, minY);
+#endif
+		}
+		
+		ctx.countSamples(counts, cr, ci, n);
+		
+		for (int k = 0; k < n; k++)
+			itr[static_cast<size_t>(y0 + (i + k) / rectWidth) * width + x0 + (i + k) % rectWidth] = counts[k];
+	}
+}
+
+// x0, y0, x1 and y1 are inclusive, and the border of the rectangle must already have been evaluated
+void subdivideRect(SubdivisionContext &ctx, int x0, int y0, int x1, int y1)
+{
+	uint32_t *itr = ctx.itrBuffer;
+	const int width = ctx.width;
+	
+	if (x1 - x0 < 2 || y1 - y0 < 2) // no interior
+		return;
+	
+	const uint32_t first = itr[y0 * width + x0];
+	bool isUniform = true;
+	
+	for (int x = x0; x <= x1 && isUniform; x++)
+		isUniform = (itr[y0 * width + x] == first) && (itr[y1 * width + x] == first);
+	
+	for (int y = y0; y <= y1 && isUniform; y++)
+		isUniform = (itr[y * width + x0] == first) && (itr[y * width + x1] == first);
+	
+	if (isUniform)
+	{
+		for (int y = y0 + 1; y < y1; y++)
+			std::fill(itr + y * width + x0 + 1, itr + y * width + x1, first);
+		return;
+	}
+	
+	if (x1 - x0 <= SUBDIVISION_MIN_SIZE || y1 - y0 <= SUBDIVISION_MIN_SIZE)
+	{
+		countRect(ctx, x0 + 1, y0 + 1, x1 - 1, y1 - 1);
+		ctx.numEvaluated += static_cast<uint64_t>(x1 - x0 - 1) * (y1 - y0 - 1);
+		return;
+	}
+	
+	// evaluate the lines splitting the rectangle into four
+	const int xm = (x0 + x1) / 2, ym = (y0 + y1) / 2;
+	
+	countRect(ctx, x0 + 1, ym, x1 - 1, ym);
+	countRect(ctx, xm, y0 + 1, xm, ym - 1);
+	countRect(ctx, xm, ym + 1, xm, y1 - 1);
+	
+	ctx.numEvaluated += (x1 - x0 - 1) + (y1 - y0 - 2);
+	
+	const bool spawnTasks = (x1 - x0 > SUBDIVISION_TASK_SIZE) || (y1 - y0 > SUBDIVISION_TASK_SIZE);
+	
+#pragma omp task shared(ctx) if (spawnTasks)
+	subdivideRect(ctx, x0, y0, xm, ym);
+	
+#pragma omp task shared(ctx) if (spawnTasks)
+	subdivideRect(ctx, xm, y0, x1, ym);
+	
+#pragma omp task shared(ctx) if (spawnTasks)
+	subdivideRect(ctx, x0, ym, xm, y1);
+	
+#pragma omp task shared(ctx) if (spawnTasks)
+	subdivideRect(ctx, xm, ym, x1, y1);
+}
+
+// Renders the frame with the Mariani-Silver algorithm, returns the number of pixels that had to be evaluated. The
+// sample kernel is only used where it maps the points like countSpan, and may be null.
+uint64_t drawMandelbrotMarianiSilver(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads, CountKernel countSpan, SampleKernel countSamples,
+									 const RowCallback &onRowDone = nullptr)
+{
+	std::vector<uint32_t> itrBuffer(static_cast<size_t>(width) * height);
+	
+	SubdivisionContext ctx;
+	ctx.itrBuffer = itrBuffer.data();
+	ctx.width = width;
+	ctx.height = height;
+	ctx.countSpan = countSpan;
+	ctx.countSamples = countSamples;
+	ctx.numEvaluated = 0;
+	
+#pragma omp parallel num_threads(nThreads)
+	{
+		// the border of the frame in pieces of SPAN_CHUNK pixels, the top and bottom rows first and then the columns
+		// in between
+		const int columnHeight = std::max(height - 2, 0);
+		const int rowPieces = (width + SPAN_CHUNK - 1) / SPAN_CHUNK, columnPieces = (columnHeight + SPAN_CHUNK - 1) / SPAN_CHUNK;
+		
+#pragma omp for schedule(dynamic, 1)
+		for (int i = 0; i < 2 * rowPieces + 2 * columnPieces; i++)
+		{
+			if (i < 2 * rowPieces)
+			{
+				const int x = (i % rowPieces) * SPAN_CHUNK, y = (i < rowPieces) ? 0 : height - 1;
+				countRect(ctx, x, y, std::min(x + SPAN_CHUNK, width) - 1, y);
+			}
+			else
+			{
+				const int j = i - 2 * rowPieces;
+				const int x = (j < columnPieces) ? 0 : width - 1, y = 1 + (j % columnPieces) * SPAN_CHUNK;
+				countRect(ctx, x, y, x, std::min(y + SPAN_CHUNK, height - 1) - 1);
+			}
+		}
+		
+#pragma omp single
+		subdivideRect(ctx, 0, 0, width - 1, height - 1);
+		
+		// colorize the iteration counts
+#pragma omp for schedule(static)
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				uint32_t index = y * width + x;
+				if (itrBuffer[index] < MAX_ITR)
+					frameBuffer[index] = BLACK;
+				else
+					frameBuffer[index] = CYAN;
+			}
+			
+			if (onRowDone)
+				onRowDone(y);
+		}
+	}
+	
+	return ctx.numEvaluated + 2 * width + 2 * std::max(height - 2, 0);
+}
+
+/*======================== PROGRESSIVE PREVIEW ========================*/
+
+// The rows are rendered interlaced: the first pass renders every PROGRESSIVE_STEP-th row, and every following pass
+// halves the step and renders only the rows in between, so that no row is ever rendered twice. Each rendered row
+// is copied into the rows below it that have not been rendered yet, so the frame buffer holds a complete, if
+// blocky, image after every pass. Whole rows are rendered, so any of the span kernels can be used.
+
+const int PROGRESSIVE_STEP = 16; // row step of the first, coarsest pass, must be a power of two
+
+// called after each pass with the frame buffer, the number of the pass and the row step of that pass
+typedef std::function<void(const Color3f *, int, int)> PassCallback;
+
+void drawMandelbrotProgressive(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads, SpanKernel drawSpan, const PassCallback &onPassDone, const RowCallback &onRowDone = nullptr)
+{
+	int pass = 0;
+	for (int step = PROGRESSIVE_STEP; step >= 1; step /= 2, pass++)
+	{
+		// rows that are a multiple of the previous step were rendered in an earlier pass
+		const int first = (step == PROGRESSIVE_STEP) ? 0 : step;
+		const int stride = (step == PROGRESSIVE_STEP) ? step : 2 * step;
+		const int numRows = (height > first) ? (height - first + stride - 1) / stride : 0;
+		
+#pragma omp parallel for num_threads(nThreads) shared(frameBuffer) schedule(dynamic, 1)
+		for (int i = 0; i < numRows; i++)
+		{
+			const int y = first + i * stride;
+			Color3f *row = frameBuffer + y * width;
+			drawSpan(row, 0, y, width, width, height);
+			
+			// the next step - 1 rows are rendered in later passes
+			for (int j = y + 1; j < std::min(y + step, height); j++)
+				std::copy(row, row + width, frameBuffer + j * width);
+			
+			if (onRowDone)
+				onRowDone(y);
+		}
+		
+		if (onPassDone)
+			onPassDone(frameBuffer, pass, step);
+	}
+}
+
+/*=====================================================================*/
+
+enum struct SIMDISA
+{
+	None,
+	SSE,
+	AVX,
+	AVX512
+};
+
+typedef void (*SIMDKernel)(Color3f *, const int &, const int &, uint32_t, const RowCallback &);
+
+const char* getISAName(SIMDISA isa)
+{
+	switch (isa)
+	{
+		case (SIMDISA::SSE):
+			return "SSE4.1";
+			
+		case (SIMDISA::AVX):
+			return "AVX2 + FMA";
+			
+		case (SIMDISA::AVX512):
+			return "AVX-512F + FMA";
+			
+		default:
+			return "None";
+	}
+}
+
+// reads the extended control register XCR0 to find out which register states the OS saves on a context switch
+uint64_t readXCR0()
+{
+	uint32_t eax = 0, edx = 0;
+	__asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (static_cast<uint64_t>(edx) << 32) | eax;
+}
+
+// queries CPUID for the widest instruction set that both the processor and the operating system support
+SIMDISA detectISA()
+{
+	uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+	
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return SIMDISA::None;
+	
+	bool hasSSE41 = ecx & bit_SSE4_1;
+	bool hasFMA = ecx & bit_FMA;
+	bool hasAVX = ecx & bit_AVX;
+	bool hasOSXSAVE = ecx & bit_OSXSAVE;
+	
+	bool hasAVX2 = false, hasAVX512F = false;
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+	{
+		hasAVX2 = ebx & bit_AVX2;
+		hasAVX512F = ebx & bit_AVX512F;
+	}
+	
+	// the OS must save the XMM/YMM (bits 1, 2) and opmask/ZMM (bits 5, 6, 7) states for AVX and AVX-512 to be usable
+	uint64_t xcr0 = hasOSXSAVE ? readXCR0() : 0;
+	bool osAVX = (xcr0 & 0x6) == 0x6;
+	bool osAVX512 = (xcr0 & 0xe6) == 0xe6;
+	
+	if (hasAVX512F && hasFMA && osAVX512)
+		return SIMDISA::AVX512;
+	
+	if (hasAVX && hasAVX2 && hasFMA && osAVX)
+		return SIMDISA::AVX;
+	
+	if (hasSSE41)
+		return SIMDISA::SSE;
+	
+	return SIMDISA::None;
+}
+
+enum struct Precision
+{
+	Single,
+	Double,
+	Perturbation
+};
+
+const char* getPrecisionName(Precision precision)
+{
+	switch (precision)
+	{
+		case (Precision::Single):
+			return "single precision";
+			
+		case (Precision::Double):
+			return "double precision";
+			
+		default:
+			return "perturbation theory";
+	}
+}
+
+// picks the cheapest arithmetic that can still tell neighbouring pixels apart at the current zoom
+Precision getRequiredPrecision(int width)
+{
+	// the fractal engine only has single precision kernels
+	if (fractal.type != FractalType::Mandelbrot)
+		return Precision::Single;
+	
+	double magnitude = std::max(std::max(std::fabs(view.getMinX()), std::fabs(view.getMinX() + view.getWidth())),
+								std::max(std::fabs(view.getMinY()), std::fabs(view.getMinY() + view.getHeight())));
+	double pixelSize = view.getWidth() / width / std::max(magnitude, 1e-300);
+	
+	if (pixelSize > 1e-5)
+		return Precision::Single;
+	
+	if (pixelSize > 1e-13)
+		return Precision::Double;
+	
+	return Precision::Perturbation;
+}
+
+template <bool isStreamed>
+SpanKernel selectSpanKernel(SIMDISA isa, Precision precision)
+{
+	if (precision == Precision::Perturbation)
+		return drawSpanPerturbation<isStreamed>;
+	
+	if (precision == Precision::Double)
+	{
+		switch (isa)
+		{
+			case (SIMDISA::AVX):
+				return drawSpanAVXDouble<isStreamed>;
+				
+			case (SIMDISA::AVX512):
+				return drawSpanAVX512Double<isStreamed>;
+				
+			default:
+				return drawSpanDouble<isStreamed>;
+		}
+	}
+	
+	switch (isa)
+	{
+		case (SIMDISA::SSE):
+			return drawSpanSSE<isStreamed>;
+			
+		case (SIMDISA::AVX):
+			return drawSpanAVX<isStreamed>;
+			
+		case (SIMDISA::AVX512):
+			return drawSpanAVX512<isStreamed>;
+			
+		default:
+			return drawSpan<isStreamed>;
+	}
+}
+
+// Streamed kernels write the frame with non-temporal stores, for the renderers that draw a whole frame that is not
+// read until it is saved. The others, or any renderer that hands the rows on as they are drawn, take the default.
+SpanKernel getSpanKernel(SIMDISA isa, Precision precision = Precision::Single, bool isStreamed = false)
+{
+	return isStreamed ? selectSpanKernel<true>(isa, precision) : selectSpanKernel<false>(isa, precision);
+}
+
+// the SSE kernel has no sample variant, since SSE4.1 hardware without AVX2 is rare by now
+SampleKernel getSampleKernel(SIMDISA isa)
+{
+	switch (isa)
+	{
+		case (SIMDISA::AVX):
+			return countSamplesAVX;
+			
+		case (SIMDISA::AVX512):
+			return countSamplesAVX512;
+			
+		default:
+			return countSamples;
+	}
+}
+
+CountKernel getCountKernel(SIMDISA isa, Precision precision = Precision::Single)
+{
+	if (precision == Precision::Perturbation)
+		return countSpanPerturbation;
+	
+	if (precision == Precision::Double)
+	{
+		switch (isa)
+		{
+			case (SIMDISA::AVX):
+				return countSpanAVXDouble;
+				
+			case (SIMDISA::AVX512):
+				return countSpanAVX512Double;
+				
+			default:
+				return countSpanDouble;
+		}
+	}
+	
+	switch (isa)
+	{
+		case (SIMDISA::SSE):
+			return countSpanSSE;
+			
+		case (SIMDISA::AVX):
+			return countSpanAVX;
+			
+		case (SIMDISA::AVX512):
+			return countSpanAVX512;
+			
+		default:
+			return countSpan;
+	}
+}
+
+SIMDKernel getSIMDKernel(SIMDISA isa)
+{
+	switch (isa)
+	{
+		case (SIMDISA::SSE):
+			return drawMandelbrotOMPSSE;
+			
+		case (SIMDISA::AVX):
+			return drawMandelbrotOMPAVX;
+			
+		case (SIMDISA::AVX512):
+			return drawMandelbrotOMPAVX512;
+			
+		default:
+			return nullptr;
+	}
+}
+
+// Renders the default view with the scalar and the SIMD span kernels of the host, once without and once with the
+// interior checks, and prints how long each took. The checks pay off the most at high iteration counts.
+void benchmarkInteriorChecks(int width, int height, SIMDISA isa)
+{
+	const uint32_t nThreads = std::thread::hardware_concurrency();
+	Color3f *frameBuffer = new Color3f[width * height];
+	
+	struct Backend
+	{
+		const char *name;
+		SpanKernel drawSpan;
+	};
+	
+	const Backend backends[] = {
+		{ "Scalar (single)", getSpanKernel(SIMDISA::None, Precision::Single) },
+		{ "SIMD (single)", getSpanKernel(isa, Precision::Single) },
+		{ "Scalar (double)", getSpanKernel(SIMDISA::None, Precision::Double) },
+		{ "SIMD (double)", getSpanKernel(isa, Precision::Double) }
+	};
+	
+	std::cout << "Benchmarking interior checks at " << width << " x " << height << ", " << MAX_ITR << " iterations, "
+			  << nThreads << " threads, " << getISAName(isa) << "\n\n";
+	std::cout << "Backend            Off (ms)     On (ms)    Speedup\n";
+	
+	for (const Backend &backend : backends)
+	{
+		double timeMSec[2];
+		for (int checks = 0; checks < 2; ++checks)
+		{
+			interiorChecks = checks;
+			auto start = std::chrono::high_resolution_clock::now();
+			drawMandelbrotOMPSpans(frameBuffer, width, height, nThreads, backend.drawSpan, nullptr);
+			auto stop = std::chrono::high_resolution_clock::now();
+			timeMSec[checks] = std::chrono::duration<double, std::milli>(stop - start).count();
+		}
+		
+		std::printf("%-16s %10.1f  %10.1f  %9.1fx\n", backend.name, timeMSec[0], timeMSec[1], timeMSec[0] / timeMSec[1]);
+	}
+	
+	interiorChecks = false;
+	delete[] frameBuffer;
+}
+
+/*======================== DEFERRED COLORIZATION =====================*/
+
+// Instead of a Color3f per pixel, the iteration counts can be rendered into a buffer of 16-bit (if MAX_ITR fits)
+// or 32-bit integers, a quarter or a third of the memory traffic, along with the fractional part of the smooth
+// iteration count if asked for. The counts are colored afterwards through a lookup table built from a palette, so
+// the palette can be swapped without rendering the frame again.
+
+const int PALETTE_PERIOD = 64; // iterations it takes to cycle once through the colors of a palette
+
+struct Palette
+{
+	const char *name;
+	std::vector<Color3f> colors; // gradient the points outside the set cycle through
+	Color3f interior; // color of the points inside the set
+};
+
+const Palette PALETTES[] = {
+	{ "Classic", { BLACK }, CYAN },
+	{ "Fire", { BLACK, RED, YELLOW, WHITE, YELLOW, RED }, BLACK },
+	{ "Ocean", { BLACK, BLUE, CYAN, WHITE, CYAN, BLUE }, BLACK }
+};
+
+// color of every iteration count from 0 to MAX_ITR, kept as separate channels for the vectorized lookups
+struct ColorLUT
+{
+	std::vector<float> r;
+	std::vector<float> g;
+	std::vector<float> b;
+	Color3f interior;
+};
+
+// color at position t along the gradient of the palette, in units of its colors, wrapping around at the end
+Color3f getPaletteColor(const Palette &palette, float t)
+{
+	const size_t numColors = palette.colors.size();
+	size_t k = static_cast<size_t>(t);
+	float u = t - k;
+	const Color3f &a = palette.colors[k % numColors], &b = palette.colors[(k + 1) % numColors];
+	return Color3f(a.r + u * (b.r - a.r), a.g + u * (b.g - a.g), a.b + u * (b.b - a.b));
+}
+
+ColorLUT buildColorLUT(const Palette &palette)
+{
+	ColorLUT lut;
+	lut.r.resize(MAX_ITR + 1);
+	lut.g.resize(MAX_ITR + 1);
+	lut.b.resize(MAX_ITR + 1);
+	lut.interior = palette.interior;
+	
+	const size_t numColors = palette.colors.size();
+	for (uint32_t n = 0; n <= MAX_ITR; n++)
+	{
+		Color3f color = getPaletteColor(palette, static_cast<float>(n % PALETTE_PERIOD) / PALETTE_PERIOD * numColors);
+		lut.r[n] = color.r;
+		lut.g[n] = color.g;
+		lut.b[n] = color.b;
+	}
+	return lut;
+}
+
+// Histogram equalization colors the escaped pixels by rank instead of by iteration count: a count is colored by the
+// share of escaped pixels that escaped before it, sweeping once through the palette. The colors then spread evenly
+// over the frame whatever MAX_ITR or the zoom are, and with the smooth fractions the gradient stays continuous.
+
+// Counts the pixels that escaped at every iteration count, leaving out the points inside the set. The histogram only
+// reaches up to the highest count that escaped in the frame, which is mostly far below MAX_ITR.
+template <typename T>
+std::vector<uint64_t> buildIterationHistogram(const T *itrBuffer, size_t count, uint32_t nThreads)
+{
+	const uint32_t maxItr = MAX_ITR;
+	uint32_t numBins = 0;
+	
+#pragma omp parallel for num_threads(nThreads) schedule(static) reduction(max : numBins)
+	for (size_t i = 0; i < count; i++)
+	{
+		if (itrBuffer[i] < maxItr)
+			numBins = std::max<uint32_t>(numBins, itrBuffer[i] + 1);
+	}
+	
+	std::vector<uint64_t> histogram(numBins);
+	std::vector<std::vector<uint64_t>> threadHistograms(nThreads);
+	
+	// every thread counts its share of the pixels into a histogram of its own, and the histograms are then summed
+	// with the bins split among the threads, so no two threads ever write to the same bin
+#pragma omp parallel num_threads(nThreads)
+	{
+		const int numThreads = omp_get_num_threads();
+		std::vector<uint64_t> &local = threadHistograms[omp_get_thread_num()];
+		local.assign(numBins, 0);
+		
+#pragma omp for schedule(static)
+		for (size_t i = 0; i < count; i++)
+		{
+			if (itrBuffer[i] < maxItr)
+				local[itrBuffer[i]]++;
+		}
+		
+#pragma omp for schedule(static)
+		for (uint32_t n = 0; n < numBins; n++)
+		{
+			uint64_t sum = 0;
+			for (int thread = 0; thread < numThreads; thread++)
+				sum += threadHistograms[thread][n];
+			histogram[n] = sum;
+		}
+	}
+	return histogram;
+}
+
+ColorLUT buildEqualizedColorLUT(const Palette &palette, const std::vector<uint64_t> &histogram)
+{
+	ColorLUT lut;
+	lut.r.resize(MAX_ITR + 1);
+	lut.g.resize(MAX_ITR + 1);
+	lut.b.resize(MAX_ITR + 1);
+	lut.interior = palette.interior;
+	
+	uint64_t total = 0;
+	for (uint64_t pixels : histogram)
+		total += pixels;
+	
+	const size_t numColors = palette.colors.size();
+	uint64_t below = 0; // escaped pixels with a lower count than n
+	for (uint32_t n = 0; n <= MAX_ITR; n++)
+	{
+		float share = total ? static_cast<float>(static_cast<double>(below) / total) : 0;
+		Color3f color = getPaletteColor(palette, share * (numColors - 1));
+		lut.r[n] = color.r;
+		lut.g[n] = color.g;
+		lut.b[n] = color.b;
+		
+		if (n < histogram.size())
+			below += histogram[n];
+	}
+	return lut;
+}
+
+// renders the iteration counts of the frame, and the smooth fractions unless fracBuffer is null
+template <typename T>
+void countMandelbrotOMPSpans(T *itrBuffer, float *fracBuffer, const int &width, const int &height, uint32_t nThreads, CountKernel countSpan)
+{
+#pragma omp parallel for num_threads(nThreads) schedule(dynamic, 1)
+	for (int y = 0; y < height; y++) // y axis of the image
+	{
+		// the kernels count into a chunk that stays in the L1 cache, and only the narrowed counts go out to memory
+		uint32_t itr[SPAN_CHUNK];
+		float frac[SPAN_CHUNK];
+		
+		for (int i = 0; i < width; i += SPAN_CHUNK)
+		{
+			int n = std::min(SPAN_CHUNK, width - i);
+			size_t index = static_cast<size_t>(y) * width + i;
+			countSpan(itr, fracBuffer ? frac : nullptr, i, y, n, width, height);
+			
+			std::copy(itr, itr + n, itrBuffer + index);
+			if (fracBuffer)
+				std::copy(frac, frac + n, fracBuffer + index);
+		}
+	}
+}
+
+// Colors the iteration counts through the lookup table, blending neighbouring entries by the smooth fractions. A
+// streamed frame is written with non-temporal stores, like the one of a streamed span kernel.
+template <typename T>
+void colorizeFrame(Color3f *frameBuffer, const T *itrBuffer, const float *fracBuffer, const int &width, const int &height, uint32_t nThreads, const ColorLUT &lut,
+				   const RowCallback &onRowDone = nullptr, bool isStreamed = false)
+{
+	const float *lutR = lut.r.data(), *lutG = lut.g.data(), *lutB = lut.b.data();
+	const Color3f interior = lut.interior;
+	const uint32_t maxItr = MAX_ITR;
+	
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for (int y = 0; y < height; y++) // y axis of the image
+	{
+		Color3f colors[SPAN_CHUNK];
+		
+		for (int x0 = 0; x0 < width; x0 += SPAN_CHUNK)
+		{
+			const int count = std::min(SPAN_CHUNK, width - x0);
+			const size_t offset = static_cast<size_t>(y) * width + x0;
+			const T *itr = itrBuffer + offset;
+			Color3f *dst = isStreamed ? colors : frameBuffer + offset;
+			
+			if (fracBuffer)
+			{
+				const float *frac = fracBuffer + offset;
+#pragma omp simd
+				for (int x = 0; x < count; x++)
+				{
+					uint32_t n = itr[x];
+					bool inside = n >= maxItr;
+					uint32_t k = inside ? 0 : n;
+					float u = frac[x];
+					dst[x].r = inside ? interior.r : lutR[k] + u * (lutR[k + 1] - lutR[k]);
+					dst[x].g = inside ? interior.g : lutG[k] + u * (lutG[k + 1] - lutG[k]);
+					dst[x].b = inside ? interior.b : lutB[k] + u * (lutB[k + 1] - lutB[k]);
+				}
+			}
+			else
+			{
+#pragma omp simd
+				for (int x = 0; x < count; x++)
+				{
+					uint32_t n = itr[x];
+					bool inside = n >= maxItr;
+					uint32_t k = inside ? 0 : n;
+					dst[x].r = inside ? interior.r : lutR[k];
+					dst[x].g = inside ? interior.g : lutG[k];
+					dst[x].b = inside ? interior.b : lutB[k];
+				}
+			}
+			
+			if (isStreamed)
+				streamStore(frameBuffer + offset, colors, count * sizeof(Color3f));
+		}
+		
+		if (isStreamed)
+			_mm_sfence();
+		
+		if (onRowDone)
+			onRowDone(y);
+	}
+}
+
+// The iteration counts of a frame in T, and their smooth fractions if asked for. The buffer belongs to the caller
+// rather than to a render, so that the counts can be colored again, with another palette or with equalization,
+// without counting the frame again, and so that its memory is reused from one frame to the next.
+template <typename T>
+struct IterationBuffer
+{
+	int width = 0;
+	int height = 0;
+	std::vector<T> itr;
+	std::vector<float> frac; // empty without smooth fractions
+	
+	void resize(int width_, int height_, bool smooth)
+	{
+		width = width_;
+		height = height_;
+		itr.resize(static_cast<size_t>(width) * height);
+		frac.resize(smooth ? itr.size() : 0);
+	}
+	
+	float *getFractions() { return frac.empty() ? nullptr : frac.data(); }
+	const float *getFractions() const { return frac.empty() ? nullptr : frac.data(); }
+};
+
+// The color pass on its own: colors the counts with the palette, equalized if asked for. A frame that no row callback
+// reads while it is colored is streamed, see colorizeFrame().
+template <typename T>
+void colorMandelbrotDeferred(Color3f *frameBuffer, const IterationBuffer<T> &counts, uint32_t nThreads, const Palette &palette, bool equalize,
+							 const RowCallback &onRowDone = nullptr)
+{
+	const ColorLUT lut = equalize ? buildEqualizedColorLUT(palette, buildIterationHistogram(counts.itr.data(), counts.itr.size(), nThreads)) : buildColorLUT(palette);
+	colorizeFrame(frameBuffer, counts.itr.data(), counts.getFractions(), counts.width, counts.height, nThreads, lut, onRowDone, !onRowDone);
+}
+
+// renders the iteration counts into counts and then colors them with the palette, equalized if asked for
+template <typename T>
+void drawMandelbrotDeferred(Color3f *frameBuffer, IterationBuffer<T> &counts, const int &width, const int &height, uint32_t nThreads, CountKernel countSpan,
+							bool smooth, bool equalize, const Palette &palette, const RowCallback &onRowDone = nullptr)
+{
+	counts.resize(width, height, smooth);
+	
+	auto start = std::chrono::high_resolution_clock::now();
+	countMandelbrotOMPSpans(counts.itr.data(), counts.getFractions(), width, height, nThreads, countSpan);
+	auto counted = std::chrono::high_resolution_clock::now();
+	colorMandelbrotDeferred(frameBuffer, counts, nThreads, palette, equalize, onRowDone);
+	auto stop = std::chrono::high_resolution_clock::now();
+	
+	std::cout << "Counted " << 8 * sizeof(T) << "-bit iterations in " << std::chrono::duration_cast<std::chrono::milliseconds>(counted - start).count()
+			  << " milliseconds, colored with the " << palette.name << " palette" << (equalize ? " (histogram equalized)" : "") << " in "
+			  << std::chrono::duration_cast<std::chrono::milliseconds>(stop - counted).count() << " milliseconds.\n";
+}
+
+/*=========================== SUPERSAMPLING ==========================*/
+
+// Anti-aliasing covers every pixel with k x k sub-samples, one at a random spot inside each cell of a k x k grid
+// over the pixel, and colors it by the share of sub-samples that lie in the set. The sub-samples of all the pixels
+// of a row are gathered into one list and iterated a register at a time, so the lanes of the SIMD kernels are kept
+// busy however the sub-samples are spread over the row. In adaptive mode the frame is rendered with one sample per
+// pixel first, and only the pixels whose iteration count differs from that of a neighbour by more than a threshold
+// are supersampled, which leaves out the flat regions that make up most of the frame.
+
+// pseudo-random offset of a sub-sample inside its cell in [0, 1), the same every time the frame is rendered
+inline float getJitter(uint32_t x, uint32_t y, uint32_t n)
+{
+	uint32_t h = (x * 0x8da6b343u) ^ (y * 0xd8163841u) ^ (n * 0xcb1ab31fu);
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return (h >> 8) * (1.0f / (1 << 24));
+}
+
+// true if the iteration count of the pixel differs from one of its four neighbours by more than the threshold
+inline bool hasEdge(const uint32_t *itrBuffer, int x, int y, const int &width, const int &height, int threshold)
+{
+	const uint32_t itr = itrBuffer[y * width + x];
+	const int neighbours[4][2] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+	
+	for (int i = 0; i < 4; i++)
+	{
+		int nx = neighbours[i][0], ny = neighbours[i][1];
+		if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+			continue;
+		
+		uint32_t other = itrBuffer[ny * width + nx];
+		if ((itr > other ? itr - other : other - itr) > static_cast<uint32_t>(threshold))
+			return true;
+	}
+	return false;
+}
+
+// renders the frame with k x k sub-samples per pixel, only around edges unless the threshold is negative, and
+// returns the number of pixels that were supersampled
+uint64_t drawMandelbrotSupersampled(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads, int k, int threshold, CountKernel countSpan, SampleKernel countSamples, const RowCallback &onRowDone = nullptr)
+{
+	const bool adaptive = threshold >= 0;
+	const int numSamples = k * k;
+	const double invW = view.getWidth() / width, invH = view.getHeight() / height;
+	const double minX = view.getMinX(), minY = view.getMinY();
+	
+	std::vector<uint32_t> itrBuffer(adaptive ? static_cast<size_t>(width) * height : 0);
+	if (adaptive)
+		countMandelbrotOMPSpans(itrBuffer.data(), nullptr, width, height, nThreads, countSpan);
+	
+	uint64_t numSupersampled = 0;
+	
+#pragma omp parallel num_threads(nThreads) reduction(+ : numSupersampled)
+	{
+		// sub-samples of the current row, reused from row to row
+		std::vector<int> pixels;
+		std::vector<float> sampleR, sampleI;
+		std::vector<uint32_t> sampleItr;
+		
+#pragma omp for schedule(dynamic, 1)
+		for (int y = 0; y < height; y++) // y axis of the image
+		{
+			Color3f *row = frameBuffer + static_cast<size_t>(y) * width;
+			pixels.clear();
+			sampleR.clear();
+			sampleI.clear();
+			
+			for (int x = 0; x < width; x++) // x axis of the image
+			{
+				if (adaptive && !hasEdge(itrBuffer.data(), x, y, width, height, threshold))
+				{
+					row[x] = (itrBuffer[y * width + x] < MAX_ITR) ? BLACK : CYAN;
+					continue;
+				}
+				
+				// the grid is centered on the point the other renderers sample
+				pixels.push_back(x);
+				for (int n = 0; n < numSamples; n++)
+				{
+					double dx = (n % k + getJitter(x, y, 2 * n)) / k - 0.5;
+					double dy = (n / k + getJitter(x, y, 2 * n + 1)) / k - 0.5;
+					sampleR.push_back((x + dx) * invW + minX);
+					sampleI.push_back((y + dy) * invH + minY);
+				}
+			}
+			
+			const int count = static_cast<int>(sampleR.size());
+			sampleItr.resize(count);
+			countSamples(sampleItr.data(), sampleR.data(), sampleI.data(), count);
+			
+			for (size_t p = 0; p < pixels.size(); p++)
+			{
+				int inside = 0;
+				for (int n = 0; n < numSamples; n++)
+					inside += (sampleItr[p * numSamples + n] >= MAX_ITR);
+				
+				float coverage = static_cast<float>(inside) / numSamples;
+				row[pixels[p]] = BLACK * (1 - coverage) + CYAN * coverage;
+			}
+			numSupersampled += pixels.size();
+			
+			if (onRowDone)
+				onRowDone(y);
+		}
+	}
+	
+	return numSupersampled;
+}
+
+/*========================== TILED RENDERING =========================*/
+
+const int TILE_SIZE = 256; // edge length of the square tiles used by the tiled renderer
+
+// Renders the frame tile by tile straight into a memory mapped binary PPM, without ever holding the whole frame
+// in memory. Every thread renders its tiles into its own buffer from a pool of tile buffers allocated once, and
+// converts each finished tile to 8-bit RGB directly in the mapped file. As soon as a whole band of tiles is done,
+// the band is dropped from the mapping and left to the page cache to write back. The resident memory therefore
+// depends on the tile size and the number of threads and not on the size of the frame.
+void drawMandelbrotTiled(int width, int height, int tileSize, uint32_t nThreads, SpanKernel drawSpan, const char *outputPath = "Mandelbrot.ppm")
+{
+	off_t headerSize = 0;
+	int fd = openPPM(outputPath, width, height, headerSize);
+	
+	const size_t rowBytes = static_cast<size_t>(width) * 3;
+	const size_t fileSize = headerSize + rowBytes * height;
+	const size_t pageSize = sysconf(_SC_PAGESIZE);
+	
+	uint8_t *image = nullptr;
+	if (ftruncate(fd, fileSize) == 0)
+		image = static_cast<uint8_t *>(mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+	
+	if (!image || image == MAP_FAILED)
+	{
+		std::cerr << "Could not map " << outputPath << " to memory. Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	const int tilesX = (width + tileSize - 1) / tileSize;
+	const int tilesY = (height + tileSize - 1) / tileSize;
+	
+	std::vector<Color3f> tilePool(static_cast<size_t>(nThreads) * tileSize * tileSize);
+	
+	// number of tiles in each band that are still being rendered
+	std::unique_ptr<std::atomic<int>[]> tilesLeft(new std::atomic<int>[tilesY]);
+	for (int i = 0; i < tilesY; ++i)
+		tilesLeft[i] = tilesX;
+	
+#pragma omp parallel num_threads(nThreads)
+	{
+		Color3f *tile = tilePool.data() + static_cast<size_t>(omp_get_thread_num()) * tileSize * tileSize;
+		
+#pragma omp for schedule(dynamic, 1)
+		for (int t = 0; t < tilesX * tilesY; ++t)
+		{
+			int tileX = t % tilesX, tileY = t / tilesX;
+			int x0 = tileX * tileSize, y0 = tileY * tileSize;
+			int w = std::min(tileSize, width - x0), h = std::min(tileSize, height - y0);
+			
+			for (int y = 0; y < h; ++y)
+				drawSpan(tile + y * w, x0, y0 + y, w, width, height);
+			
+			uint8_t *dst = image + headerSize + y0 * rowBytes + x0 * 3;
+			for (int y = 0; y < h; ++y)
+				packRGB8(tile + y * w, dst + y * rowBytes, w);
+			
+			if (--tilesLeft[tileY] == 0)
+			{
+				// the band is complete, its dirty pages stay in the page cache once they are unmapped
+				size_t begin = headerSize + y0 * rowBytes;
+				size_t end = std::min(begin + h * rowBytes + pageSize - 1, fileSize);
+				begin -= begin % pageSize;
+				end -= end % pageSize;
+				if (end > begin)
+					madvise(image + begin, end - begin, MADV_DONTNEED);
+			}
+		}
+	}
+	
+	munmap(image, fileSize);
+	close(fd);
+}
+
+/*============================= ANIMATION ============================*/
+
+struct Keyframe
+{
+	DoubleDouble centerX;
+	DoubleDouble centerY;
+	double scale;
+};
 
+// reads "real imaginary zoom" per line, skipping empty lines and lines starting with #
+std::vector<Keyframe> loadKeyframes(const char *keyframePath)
+{
+	std::ifstream in(keyframePath);
+	if (!in)
+	{
+		std::cerr << "Could not open " << keyframePath << ". Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	std::vector<Keyframe> keyframes;
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		
+		std::istringstream fields(line);
+		std::string centerX, centerY;
+		Keyframe keyframe;
+		if (!(fields >> centerX >> centerY >> keyframe.scale) || !(keyframe.scale > 0))
+		{
+			std::cerr << "Invalid keyframe \"" << line << "\" in " << keyframePath << ". Aborting..." << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+		
+		keyframe.centerX = parseDoubleDouble(centerX);
+		keyframe.centerY = parseDoubleDouble(centerY);
+		keyframes.push_back(keyframe);
+	}
+	
+	if (keyframes.empty())
+	{
+		std::cerr << "No keyframes found in " << keyframePath << ". Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	return keyframes;
+}
+
+// view at position t along the path, where t = 1 is the second keyframe and so on
+Viewport interpolateKeyframes(const std::vector<Keyframe> &keyframes, double t)
+{
+	int k = std::min(static_cast<int>(t), static_cast<int>(keyframes.size()) - 1);
+	const Keyframe &a = keyframes[k];
+	const Keyframe &b = keyframes[std::min(k + 1, static_cast<int>(keyframes.size()) - 1)];
+	double u = t - k;
+	
+	Viewport v;
+	v.scale = a.scale * std::pow(b.scale / a.scale, u); // constant zoom rate
+	
+	// the center moves in proportion to the shrinking view, so that the target stays in the frame while zooming in
+	double w = (a.scale == b.scale) ? u : (1 - a.scale / v.scale) / (1 - a.scale / b.scale);
+	v.centerX = a.centerX + (b.centerX - a.centerX) * DoubleDouble(w);
+	v.centerY = a.centerY + (b.centerY - a.centerY) * DoubleDouble(w);
+	return v;
+}
+
+// converts a whole frame to 8-bit RGB in the staging buffer and writes it out as a binary PPM
+bool encodeFrameP6(const Color3f *frameBuffer, int width, int height, std::vector<uint8_t> &staging, std::string outputPath)
+{
+	off_t offset = 0;
+	int fd = openPPM(outputPath.c_str(), width, height, offset);
+	
+	packRGB8(frameBuffer, staging.data(), static_cast<size_t>(width) * height);
+	bool ok = writeAll(fd, staging.data(), staging.size(), offset);
+	
+	close(fd);
+	return ok;
+}
+
+// Renders the frames of a zoom along the keyframes. Frames are rendered into two frame buffers in turn, and each
+// finished frame is encoded and written by a background task while the next one is rendered by all the threads.
+void renderAnimation(const std::vector<Keyframe> &keyframes, int numFrames, int width, int height, SIMDISA isa, const std::string &prefix)
+{
+	const uint32_t nThreads = std::thread::hardware_concurrency();
+	const size_t bufferSize = static_cast<size_t>(width) * height;
+	
+	std::vector<Color3f> frameBuffers[2] = { std::vector<Color3f>(bufferSize), std::vector<Color3f>(bufferSize) };
+	std::vector<uint8_t> staging(bufferSize * 3);
+	std::future<bool> pending;
+	bool ok = true;
+	bool hasOrbit = false;
+	DoubleDouble orbitX, orbitY;
+	
+	auto start = std::chrono::high_resolution_clock::now();
+	
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		double t = (numFrames > 1) ? static_cast<double>(frame) * (keyframes.size() - 1) / (numFrames - 1) : 0;
+		view = interpolateKeyframes(keyframes, t);
+		
+		// the reference orbit only depends on the center, which stays put while zooming into a single point
+		const Precision precision = getRequiredPrecision(width);
+		if (precision == Precision::Perturbation && (!hasOrbit || orbitX.hi != view.centerX.hi || orbitX.lo != view.centerX.lo
+													 || orbitY.hi != view.centerY.hi || orbitY.lo != view.centerY.lo))
+		{
+			computeReferenceOrbit();
+			orbitX = view.centerX;
+			orbitY = view.centerY;
+			hasOrbit = true;
+		}
+		
+		Color3f *frameBuffer = frameBuffers[frame % 2].data();
+		auto frameStart = std::chrono::high_resolution_clock::now();
+		drawMandelbrotOMPSpans(frameBuffer, width, height, nThreads, getSpanKernel(isa, precision), nullptr);
+		auto frameStop = std::chrono::high_resolution_clock::now();
+		
+		// the staging buffer is shared, so the previous frame has to be written out before this one is
+		if (pending.valid())
+			ok &= pending.get();
+		
+		char outputPath[32];
+		std::snprintf(outputPath, sizeof(outputPath), "_%05d.ppm", frame);
+		pending = std::async(std::launch::async, encodeFrameP6, frameBuffer, width, height, std::ref(staging), prefix + outputPath);
+		
+		std::cout << "Frame " << frame + 1 << " of " << numFrames << " (zoom " << view.scale << ", " << getPrecisionName(precision)
+				  << ") rendered in " << std::chrono::duration_cast<std::chrono::milliseconds>(frameStop - frameStart).count() << " milliseconds.\n";
+	}
+	
+	if (pending.valid())
+		ok &= pending.get();
+	
+	if (!ok)
+	{
+		std::cerr << "Could not write all the frames. Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	auto stop = std::chrono::high_resolution_clock::now();
+	double totalSec = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() / 1000.0;
+	std::cout << numFrames << " frames in " << totalSec << " seconds (" << numFrames / totalSec << " frames per second).\n";
+}
 
-				//////////////////////// evalMandel(z, c)//////////////////////////////////
+/*============================ RENDER FARM ===========================*/
 
-				_a = _zr;
-				_b = _zi;
+// The coordinator splits the frame into tiles and hands them out to worker processes over Unix domain sockets. The
+// workers are copies of this program started with "--farm-worker fd", which render the tiles they are sent with
+// the count kernel of their host and send back the iteration counts. Every worker keeps a couple of tiles queued so
+// it never waits for the next one, and the tiles of a worker that dies or stops answering are handed to the others.
 
-				_zr = _mm256_sub_ps(_zr2, _zi2); // zr = zr * zr - zi * zi
-				_zr = _mm256_add_ps(_zr, _cr); // zr += cr
+const int FARM_TILE_SIZE = 64;
+const int FARM_PIPELINE = 2; // tiles sent ahead to every worker
+const std::chrono::seconds FARM_TILE_TIMEOUT(30); // a worker that takes longer for one tile is taken for hung and killed
 
-				_zi = _mm256_mul_ps(_a, _b); // zi = a * b
+// everything a worker needs to render its tiles exactly like the coordinator would, sent once after startup. The
+// coordinator and the workers are the same binary, so the structs go over the socket as they are.
+struct FarmJob
+{
+	int32_t width;
+	int32_t height;
+	int32_t nThreads; // threads per worker
+	uint32_t maxItr;
+	double centerX[2]; // hi and lo of the DoubleDouble
+	double centerY[2];
+	double scale;
+	int32_t interiorChecks;
+	int32_t fractalType;
+	int32_t power;
+	float juliaR;
+	float juliaI;
+};
+
+// a tile request, and the header of its reply, which is followed by width * height iteration counts. A tile with
+// no width tells the worker to exit.
+struct FarmTile
+{
+	int32_t x0;
+	int32_t y0;
+	int32_t width;
+	int32_t height;
+};
+
+bool sendAll(int fd, const void *data, size_t size)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	while (size > 0)
+	{
+		ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL); // a dead peer fails the call instead of raising SIGPIPE
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
 
-				// zi = zi * 2 + ci
-				_zi = _mm256_fmadd_ps(_zi, _const2, _ci);
+bool recvAll(int fd, void *data, size_t size)
+{
+	uint8_t *bytes = static_cast<uint8_t *>(data);
+	while (size > 0)
+	{
+		ssize_t received = recv(fd, bytes, size, 0);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0)
+			return false;
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
 
-				//////////////////////// evalMandel(z, c)//////////////////////////////////
+// the loop of a worker process, until it is told to exit or the coordinator goes away
+int runFarmWorker(int fd)
+{
+	FarmJob job;
+	if (!recvAll(fd, &job, sizeof(job)))
+		return EXIT_FAILURE;
+	
+	MAX_ITR = job.maxItr;
+	view.centerX = DoubleDouble(job.centerX[0], job.centerX[1]);
+	view.centerY = DoubleDouble(job.centerY[0], job.centerY[1]);
+	view.scale = job.scale;
+	interiorChecks = job.interiorChecks;
+	fractal.type = static_cast<FractalType>(job.fractalType);
+	fractal.power = job.power;
+	fractal.juliaR = job.juliaR;
+	fractal.juliaI = job.juliaI;
+	
+	const Precision precision = getRequiredPrecision(job.width);
+	if (precision == Precision::Perturbation)
+		computeReferenceOrbit();
+	const CountKernel countSpan = getCountKernel(detectISA(), precision);
+	
+	std::vector<uint32_t> counts(FARM_TILE_SIZE * FARM_TILE_SIZE);
+	FarmTile tile;
+	while (recvAll(fd, &tile, sizeof(tile)) && tile.width > 0)
+	{
+		counts.resize(static_cast<size_t>(tile.width) * tile.height);
+		
+#pragma omp parallel for num_threads(job.nThreads) schedule(dynamic, 1)
+		for (int y = 0; y < tile.height; y++)
+			countSpan(counts.data() + static_cast<size_t>(y) * tile.width, nullptr, tile.x0, tile.y0 + y, tile.width, job.width, job.height);
+		
+		if (!sendAll(fd, &tile, sizeof(tile)) || !sendAll(fd, counts.data(), counts.size() * sizeof(uint32_t)))
+			return EXIT_FAILURE;
+	}
+	
+	close(fd);
+	return EXIT_SUCCESS;
+}
 
+struct FarmWorker
+{
+	pid_t pid;
+	int fd;
+	std::deque<FarmTile> inFlight; // tiles sent to the worker and not yet returned, in the order it renders them
+	uint64_t tilesDone;
+	std::chrono::steady_clock::time_point deadline; // by when the tile at the front of inFlight has to come back
+};
 
-				// itr++;
-				_inc1i = _mm256_and_si256(_mm256_castps_si256(_maskwhile), _const1i);
-				_itr = _mm256_add_epi32(_itr, _inc1i);
+// starts a copy of this program as a worker on one end of a new socket pair, returns the other end
+FarmWorker spawnFarmWorker()
+{
+	int sockets[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0)
+	{
+		std::cerr << "Could not create a socket pair for a worker. Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		std::cerr << "Could not start a worker process. Aborting..." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	
+	if (pid == 0)
+	{
+		// only the worker's own end survives the exec, and the worker does not outlive the coordinator
+		fcntl(sockets[1], F_SETFD, 0);
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		std::string fd = std::to_string(sockets[1]);
+		execl("/proc/self/exe", "Mandelbrot", "--farm-worker", fd.c_str(), static_cast<char *>(nullptr));
+		_exit(127);
+	}
+	
+	// a worker that stops halfway through a reply, or no longer reads its tiles, must not block the coordinator
+	close(sockets[1]);
+	const timeval timeout = { static_cast<time_t>(FARM_TILE_TIMEOUT.count()), 0 };
+	setsockopt(sockets[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(sockets[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	return { pid, sockets[0], {}, 0, {} };
+}
 
-				// if (any one register satisfies while condition) goto loop;
-				if (_mm256_movemask_ps(_maskwhile) > 0)
-					goto loop;
+// Renders the iteration counts of the current view with numWorkers worker processes, nThreads threads each. The
+// tiles of a worker that crashes, hangs up or misses the deadline of a tile are rendered by the remaining workers.
+void countMandelbrotFarm(uint32_t *itrBuffer, int width, int height, int numWorkers, int nThreads)
+{
+	const FarmJob job = { width, height, nThreads, MAX_ITR, { view.centerX.hi, view.centerX.lo }, { view.centerY.hi, view.centerY.lo },
+						  view.scale, interiorChecks, static_cast<int32_t>(fractal.type), fractal.power, fractal.juliaR, fractal.juliaI };
+	
+	std::deque<FarmTile> pending;
+	for (int y0 = 0; y0 < height; y0 += FARM_TILE_SIZE)
+		for (int x0 = 0; x0 < width; x0 += FARM_TILE_SIZE)
+			pending.push_back({ x0, y0, std::min(FARM_TILE_SIZE, width - x0), std::min(FARM_TILE_SIZE, height - y0) });
+	const size_t numTiles = pending.size();
+	
+	std::vector<FarmWorker> workers;
+	for (int i = 0; i < numWorkers; i++)
+		workers.push_back(spawnFarmWorker());
+	
+	// drops a worker and puts the tiles it still owed back in front of the queue
+	auto retire = [&](FarmWorker &worker, const char *reason)
+	{
+		std::cerr << "Worker " << worker.pid << " " << reason << ", handing its " << worker.inFlight.size() << " tiles to the others.\n";
+		pending.insert(pending.begin(), worker.inFlight.begin(), worker.inFlight.end());
+		worker.inFlight.clear();
+		close(worker.fd);
+		worker.fd = -1;
+		kill(worker.pid, SIGKILL); // it may still be alive but stuck
+		waitpid(worker.pid, nullptr, 0);
+	};
+	
+	for (FarmWorker &worker : workers)
+		if (!sendAll(worker.fd, &job, sizeof(job)))
+			retire(worker, "went away");
+	
+	std::vector<uint32_t> counts;
+	std::vector<pollfd> polled;
+	std::vector<FarmWorker *> polledWorkers;
+	
+	for (size_t tilesDone = 0; tilesDone < numTiles;)
+	{
+		// keep every worker busy, including with the tiles of a worker that went away
+		for (FarmWorker &worker : workers)
+		{
+			while (worker.fd >= 0 && worker.inFlight.size() < FARM_PIPELINE && !pending.empty())
+			{
+				if (!sendAll(worker.fd, &pending.front(), sizeof(FarmTile)))
+				{
+					retire(worker, "went away");
+					break;
+				}
+				if (worker.inFlight.empty())
+					worker.deadline = std::chrono::steady_clock::now() + FARM_TILE_TIMEOUT;
+				worker.inFlight.push_back(pending.front());
+				pending.pop_front();
+			}
+		}
+		
+		// wait no longer than until the earliest deadline, a worker that is alive but stuck never wakes the poll up
+		polled.clear();
+		polledWorkers.clear();
+		auto wakeUp = std::chrono::steady_clock::time_point::max();
+		for (FarmWorker &worker : workers)
+		{
+			if (worker.fd >= 0)
+			{
+				polled.push_back({ worker.fd, POLLIN, 0 });
+				polledWorkers.push_back(&worker);
+				if (!worker.inFlight.empty())
+					wakeUp = std::min(wakeUp, worker.deadline);
+			}
+		}
+		
+		if (polled.empty())
+		{
+			std::cerr << "All the workers went away. Aborting..." << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+		
+		int timeout = -1;
+		if (wakeUp != std::chrono::steady_clock::time_point::max())
+		{
+			auto remaining = std::chrono::ceil<std::chrono::milliseconds>(wakeUp - std::chrono::steady_clock::now());
+			timeout = static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+		}
+		
+		if (poll(polled.data(), polled.size(), timeout) < 0 && errno != EINTR)
+		{
+			std::cerr << "Could not wait for the workers. Aborting..." << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+		
+		for (size_t i = 0; i < polled.size(); i++)
+		{
+			if (!polled[i].revents)
+				continue;
+			
+			// a worker only ever speaks to return a tile, anything else means it hung up or is out of step
+			FarmWorker &worker = *polledWorkers[i];
+			FarmTile tile;
+			if (worker.inFlight.empty() || !recvAll(worker.fd, &tile, sizeof(tile)) || tile.x0 != worker.inFlight.front().x0
+				|| tile.y0 != worker.inFlight.front().y0)
+			{
+				retire(worker, "went away");
+				continue;
+			}
+			
+			tile = worker.inFlight.front();
+			counts.resize(static_cast<size_t>(tile.width) * tile.height);
+			if (!recvAll(worker.fd, counts.data(), counts.size() * sizeof(uint32_t)))
+			{
+				retire(worker, "went away");
+				continue;
+			}
+			
+			for (int y = 0; y < tile.height; y++)
+				std::copy(counts.data() + static_cast<size_t>(y) * tile.width, counts.data() + static_cast<size_t>(y + 1) * tile.width,
+						  itrBuffer + static_cast<size_t>(tile.y0 + y) * width + tile.x0);
+			
+			worker.inFlight.pop_front();
+			worker.tilesDone++;
+			tilesDone++;
+			if (!worker.inFlight.empty())
+				worker.deadline = std::chrono::steady_clock::now() + FARM_TILE_TIMEOUT;
+		}
+		
+		// a worker that has not returned its tile in time is killed, so that waiting for it cannot block either
+		const auto now = std::chrono::steady_clock::now();
+		for (FarmWorker &worker : workers)
+			if (worker.fd >= 0 && !worker.inFlight.empty() && now >= worker.deadline)
+				retire(worker, "missed the deadline of a tile");
+	}
+	
+	const FarmTile exitTile = { 0, 0, 0, 0 };
+	for (FarmWorker &worker : workers)
+	{
+		if (worker.fd < 0)
+			continue;
+		
+		sendAll(worker.fd, &exitTile, sizeof(exitTile));
+		close(worker.fd);
+		waitpid(worker.pid, nullptr, 0);
+		std::cout << "Worker " << worker.pid << " rendered " << worker.tilesDone << " tiles.\n";
+	}
+}
 
-				///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
+/*============================ BENCHMARKING ==========================*/
 
-				// if (itr < MAX_ITR) frameBuffer[index] = BLACK;
-				// else frameBuffer[index] = CYAN;
+// usage: --benchmark [--size width height] [--iterations n] [--backends scalar,omp,mt,sse,avx,avx512]
+//                    [--threads n] [--repetitions n] [--interior] [--placement main|first-touch|interleave] [--pin]
+//                    [--pages small|transparent|explicit] [--format json|csv]
+struct BenchmarkOptions
+{
+	int width = 1920;
+	int height = 1080;
+	uint32_t iterations = 1000;
+	std::vector<std::string> backends = { "scalar", "omp", "mt", "sse", "avx", "avx512" };
+	uint32_t nThreads = std::thread::hardware_concurrency();
+	int repetitions = 10;
+	bool interiorChecks = false;
+	Placement placement = Placement::FirstTouch;
+	bool pinThreads = false;
+	PageSize pageSize = PageSize::Small;
+	bool json = true;
+};
 
+void exitWithBenchmarkUsage(const std::string &error)
+{
+	std::cerr << error << "\nUsage: --benchmark [--size width height] [--iterations n] [--backends scalar,omp,mt,sse,avx,avx512] "
+			  << "[--threads n] [--repetitions n] [--interior] [--placement main|first-touch|interleave] [--pin] "
+			  << "[--pages small|transparent|explicit] [--format json|csv]" << std::endl;
+	std::exit(EXIT_FAILURE);
+}
 
-				// pixel masks read in correct endianness |7, 6, 5, 4, 3, 2, 1, 0| instead of |0, 1, 2, 3, 4, 5, 6, 7| 			
-				int pixel0 = _mm256_extract_epi32(_masknumitr, 7);
-				int pixel1 = _mm256_extract_epi32(_masknumitr, 6);
-				int pixel2 = _mm256_extract_epi32(_masknumitr, 5);
-				int pixel3 = _mm256_extract_epi32(_masknumitr, 4);
-				int pixel4 = _mm256_extract_epi32(_masknumitr, 3);
-				int pixel5 = _mm256_extract_epi32(_masknumitr, 2);
-				int pixel6 = _mm256_extract_epi32(_masknumitr, 1);
-				int pixel7 = _mm256_extract_epi32(_masknumitr, 0);
+BenchmarkOptions parseBenchmarkOptions(int argc, char **argv)
+{
+	BenchmarkOptions options;
+	
+	for (int i = 2; i < argc; i++)
+	{
+		std::string option = argv[i];
+		auto needs = [&](int numValues) {
+			if (i + numValues >= argc)
+				exitWithBenchmarkUsage("Missing value for " + option + ".");
+		};
+		
+		if (option == "--size")
+		{
+			needs(2);
+			options.width = std::atoi(argv[++i]);
+			options.height = std::atoi(argv[++i]);
+		}
+		else if (option == "--iterations")
+		{
+			needs(1);
+			options.iterations = std::atoi(argv[++i]);
+		}
+		else if (option == "--backends")
+		{
+			needs(1);
+			options.backends.clear();
+			std::istringstream list(argv[++i]);
+			for (std::string backend; std::getline(list, backend, ',');)
+				options.backends.push_back(backend);
+		}
+		else if (option == "--threads")
+		{
+			needs(1);
+			options.nThreads = std::atoi(argv[++i]);
+		}
+		else if (option == "--repetitions")
+		{
+			needs(1);
+			options.repetitions = std::atoi(argv[++i]);
+		}
+		else if (option == "--interior")
+			options.interiorChecks = true;
+		else if (option == "--placement")
+		{
+			needs(1);
+			std::string placement = argv[++i];
+			if (placement == "main")
+				options.placement = Placement::MainThread;
+			else if (placement == "first-touch")
+				options.placement = Placement::FirstTouch;
+			else if (placement == "interleave")
+				options.placement = Placement::Interleave;
+			else
+				exitWithBenchmarkUsage("Unknown placement " + placement + ".");
+		}
+		else if (option == "--pin")
+			options.pinThreads = true;
+		else if (option == "--pages")
+		{
+			needs(1);
+			std::string pages = argv[++i];
+			if (pages == "small")
+				options.pageSize = PageSize::Small;
+			else if (pages == "transparent")
+				options.pageSize = PageSize::TransparentHuge;
+			else if (pages == "explicit")
+				options.pageSize = PageSize::ExplicitHuge;
+			else
+				exitWithBenchmarkUsage("Unknown page size " + pages + ".");
+		}
+		else if (option == "--format")
+		{
+			needs(1);
+			std::string format = argv[++i];
+			if (format != "json" && format != "csv")
+				exitWithBenchmarkUsage("Unknown format " + format + ".");
+			options.json = (format == "json");
+		}
+		else
+			exitWithBenchmarkUsage("Unknown option " + option + ".");
+	}
+	
+	if (options.width < 1 || options.height < 1 || options.iterations < 1 || options.nThreads < 1 || options.repetitions < 1)
+		exitWithBenchmarkUsage("Invalid value.");
+	
+	return options;
+}
 
+struct BenchmarkResult
+{
+	std::string backend;
+	double minMSec;
+	double medianMSec;
+	double p99MSec;
+	double mpixelsPerSec; // at the median time
+	double gitrPerSec; // iteration counts of all the pixels summed up, at the median time
+	double remoteShare; // share of the frame buffer pages written from a remote node, -1 if unknown
+};
 
-				frameBuffer[index0] = pixel0 ? BLACK : CYAN;
-				frameBuffer[index1] = pixel1 ? BLACK : CYAN;
-				frameBuffer[index2] = pixel2 ? BLACK : CYAN;
-				frameBuffer[index3] = pixel3 ? BLACK : CYAN;
-				frameBuffer[index4] = pixel4 ? BLACK : CYAN;
-				frameBuffer[index5] = pixel5 ? BLACK : CYAN;
-				frameBuffer[index6] = pixel6 ? BLACK : CYAN;
-				frameBuffer[index7] = pixel7 ? BLACK : CYAN;
+// Renders the default view with every requested backend, one untimed warm-up run and then the given number of
+// timed repetitions each, and prints the statistics as JSON or CSV to stdout. Every backend gets a frame buffer of
+// its own, placed for its threads, and one more untimed run records the node every row is finished on, to tell how
+// many pages were written from a remote node. Backends the processor does not support are left out with a note to
+// stderr.
+void runBenchmark(const BenchmarkOptions &options, SIMDISA isa)
+{
+	const int width = options.width, height = options.height;
+	const uint32_t nThreads = options.nThreads;
+	MAX_ITR = options.iterations;
+	interiorChecks = options.interiorChecks;
+	pinThreads = options.pinThreads;
+	PinnedThreads pinnedThreads(nThreads, pinThreads);
+	
+	// The sum of the iteration counts is the same for every backend, apart from rounding in the SIMD kernels. It
+	// counts MAX_ITR for the points inside the set even where the interior checks skipped them, see note [12].
+	std::vector<uint32_t> itrBuffer(static_cast<size_t>(width) * height);
+	countMandelbrotOMPSpans(itrBuffer.data(), nullptr, width, height, nThreads, getCountKernel(isa));
+	uint64_t totalItr = 0;
+	for (uint32_t itr : itrBuffer)
+		totalItr += itr;
+	
+	std::vector<BenchmarkResult> results;
+	for (const std::string &backend : options.backends)
+	{
+		Color3f *frameBuffer = nullptr;
+		std::function<void(const RowCallback &)> render;
+		if (backend == "scalar")
+			render = [&](const RowCallback &onRowDone) { drawMandelbrot(frameBuffer, width, height, onRowDone); };
+		else if (backend == "omp")
+			render = [&](const RowCallback &onRowDone) { drawMandelbrotOMP(frameBuffer, width, height, nThreads, onRowDone); };
+		else if (backend == "mt")
+			render = [&](const RowCallback &onRowDone) { drawMandelbrotMT(frameBuffer, width, height, nThreads, onRowDone); };
+		else if (backend == "sse" || backend == "avx" || backend == "avx512")
+		{
+			SIMDISA required = (backend == "sse") ? SIMDISA::SSE : (backend == "avx") ? SIMDISA::AVX : SIMDISA::AVX512;
+			if (isa < required)
+			{
+				std::cerr << "Skipping " << backend << ", which this processor does not support." << std::endl;
+				continue;
 			}
+			SpanKernel drawSpan = getSpanKernel(required);
+			render = [&, drawSpan](const RowCallback &onRowDone) { drawMandelbrotOMPSpans(frameBuffer, width, height, nThreads, drawSpan, onRowDone); };
+		}
+		else
+			exitWithBenchmarkUsage("Unknown backend " + backend + ".");
+		
+		// the scalar renderer runs on the main thread alone, and the STL threads start out with bands of tiles
+		frameBuffer = allocateFrameBuffer(width, height, options.placement, (backend == "scalar") ? 1 : nThreads, (backend == "mt") ? MT_TILE_SIZE : 0,
+										  options.pageSize);
+		
+		render(nullptr); // warm-up
+		
+		std::vector<double> timeMSec;
+		for (int i = 0; i < options.repetitions; i++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			render(nullptr);
+			auto stop = std::chrono::high_resolution_clock::now();
+			timeMSec.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+		}
+		
+		// nearest rank percentiles
+		std::sort(timeMSec.begin(), timeMSec.end());
+		auto percentile = [&](double p) {
+			size_t rank = static_cast<size_t>(std::ceil(p / 100 * timeMSec.size()));
+			return timeMSec[std::max(rank, static_cast<size_t>(1)) - 1];
+		};
+		
+		BenchmarkResult result;
+		result.backend = backend;
+		result.minMSec = timeMSec.front();
+		result.medianMSec = percentile(50);
+		result.p99MSec = percentile(99);
+		result.mpixelsPerSec = static_cast<double>(width) * height / result.medianMSec / 1e3;
+		result.gitrPerSec = totalItr / result.medianMSec / 1e6;
+		
+		// the STL threads report a band of rows from the thread that finished its last tile
+		std::vector<int> rowNodes(height, -1);
+		render([&](int y) { rowNodes[y] = getCurrentNode(); });
+		result.remoteShare = getRemoteShare(frameBuffer, width, height, rowNodes);
+		
+		freeFrameBuffer(frameBuffer, width, height);
+		results.push_back(result);
+	}
+	
+	if (options.json)
+	{
+		std::printf("{\n  \"width\": %d,\n  \"height\": %d,\n  \"iterations\": %u,\n  \"threads\": %u,\n  \"repetitions\": %d,\n"
+					"  \"interior_checks\": %s,\n  \"isa\": \"%s\",\n  \"numa_nodes\": %d,\n  \"placement\": \"%s\",\n"
+					"  \"pinned_threads\": %s,\n  \"pages\": \"%s\",\n  \"results\": [",
+					width, height, MAX_ITR, nThreads, options.repetitions, interiorChecks ? "true" : "false", getISAName(isa),
+					getNumNUMANodes(), getPlacementName(options.placement), pinThreads ? "true" : "false", getPageSizeName(options.pageSize));
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BenchmarkResult &r = results[i];
+			char remoteShare[32] = "null";
+			if (r.remoteShare >= 0)
+				std::snprintf(remoteShare, sizeof(remoteShare), "%.4f", r.remoteShare);
+			std::printf("%s\n    { \"backend\": \"%s\", \"min_ms\": %.3f, \"median_ms\": %.3f, \"p99_ms\": %.3f, "
+						"\"mpixels_per_s\": %.3f, \"giterations_per_s\": %.3f, \"remote_page_share\": %s }",
+						i ? "," : "", r.backend.c_str(), r.minMSec, r.medianMSec, r.p99MSec, r.mpixelsPerSec, r.gitrPerSec, remoteShare);
+		}
+		std::printf("\n  ]\n}\n");
+	}
+	else
+	{
+		std::printf("backend,width,height,iterations,threads,repetitions,interior_checks,numa_nodes,placement,pinned_threads,pages,"
+					"min_ms,median_ms,p99_ms,mpixels_per_s,giterations_per_s,remote_page_share\n");
+		for (const BenchmarkResult &r : results)
+		{
+			std::printf("%s,%d,%d,%u,%u,%d,%d,%d,%s,%d,%s,%.3f,%.3f,%.3f,%.3f,%.3f,", r.backend.c_str(), width, height, MAX_ITR, nThreads,
+						options.repetitions, interiorChecks, getNumNUMANodes(), getPlacementName(options.placement), pinThreads, getPageSizeName(options.pageSize),
+						r.minMSec, r.medianMSec, r.p99MSec, r.mpixelsPerSec, r.gitrPerSec);
+			if (r.remoteShare >= 0)
+				std::printf("%.4f", r.remoteShare);
+			std::printf("\n");
 		}
 	}
+	
+	interiorChecks = false;
+	pinThreads = false;
+	pinnedThreads.restore();
 }
 
-#endif // ISA_AVX
-
-/////////////////////////////////////////////// AVX END ///////////////////////////////////////////////
-
-
-
-/////////////////////////////////////////////// AVX-512 BEGIN /////////////////////////////////////////////
-
-#ifdef ISA_AVX512
-
-void drawMandelbrotOMPAVX512(Color3f *frameBuffer, const int &width, const int &height, uint32_t nThreads)
+// opens a counter of the data TLB misses of loads or stores by the calling thread in user space, -1 if not allowed
+int openTLBMissCounter(bool stores)
 {
-	float invW = (1. / width) * 3.5, invH = (1. / height) * 2;	
+	perf_event_attr attr = {};
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | ((stores ? PERF_COUNT_HW_CACHE_OP_WRITE : PERF_COUNT_HW_CACHE_OP_READ) << 8) |
+				  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
 	
-#pragma omp parallel num_threads(nThreads) shared(frameBuffer)
-	{	
-		// 32-bit float registers
-		__m512 _zr, _zi, _cr, _ci, _a, _b, _zr2, _zi2, _const2, _invw, _invh, _const2p5neg,
-			_const1neg, _mod, _const4, _xf, _yf;
-
-		// 32-bit signed int registers
-		__m512i _itr, _constmaxitr, _inc1i, _const1i;
-
-		// initialize floating point registers
-		_const1neg = _mm512_set1_ps(-1.0);
-		_const2 = _mm512_set1_ps(2.0);
-		_const4 = _mm512_set1_ps(4.0);
-		_const2p5neg = _mm512_set1_ps(-2.5);
-
-		_invw = _mm512_set1_ps(invW);
-		_invh = _mm512_set1_ps(invH);
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
 
-		// initialize integer registers
-		_constmaxitr = _mm512_set1_epi32(MAX_ITR);
-		_const1i = _mm512_set1_epi32(1);	
+// Colors a large frame from the same iteration counts with small, transparent huge and explicit huge pages, with and
+// without non-temporal stores. The coloring pass is the one that is bound by memory rather than arithmetic. Prints
+// the store bandwidth at the median of a few passes with all the threads, and the data TLB misses of one pass with
+// a single thread, as the counters only follow the thread that opens them.
+void benchmarkFrameMemory(int width, int height, SIMDISA isa)
+{
+	const int REPETITIONS = 5;
+	const uint32_t nThreads = std::thread::hardware_concurrency();
+	const size_t bufferSize = static_cast<size_t>(width) * height;
+	const double frameGB = bufferSize * sizeof(Color3f) / 1e9;
+	
+	std::vector<uint32_t> itrBuffer(bufferSize);
+	countMandelbrotOMPSpans(itrBuffer.data(), nullptr, width, height, nThreads, getCountKernel(isa));
+	const ColorLUT lut = buildColorLUT(PALETTES[0]);
+	
+	int loadCounter = openTLBMissCounter(false), storeCounter = openTLBMissCounter(true);
+	if (loadCounter < 0 || storeCounter < 0)
+		std::cerr << "The data TLB miss counters are not available (see /proc/sys/kernel/perf_event_paranoid)." << std::endl;
+	
+	auto countMisses = [](int counter) -> std::string {
+		long long misses = 0;
+		if (counter < 0 || ioctl(counter, PERF_EVENT_IOC_DISABLE, 0) != 0 || read(counter, &misses, sizeof(misses)) != sizeof(misses))
+			return "n/a";
+		return std::to_string(misses);
+	};
+	
+	std::cout << "Coloring " << width << " x " << height << " (" << frameGB * 1e3 << " MB) with " << nThreads << " threads\n\n";
+	std::printf("%-17s %-9s %10s %18s %18s\n", "Pages", "Stores", "GB/s", "dTLB load misses", "dTLB store misses");
+	
+	const PageSize pageSizes[] = { PageSize::Small, PageSize::TransparentHuge, PageSize::ExplicitHuge };
+	for (PageSize requested : pageSizes)
+	{
+		// explicit huge pages are only there if enough of them were reserved beforehand
+		PageSize pageSize = requested;
+		freeBuffer(allocateBuffer(bufferSize * sizeof(Color3f), pageSize), bufferSize * sizeof(Color3f));
+		if (pageSize != requested)
+		{
+			std::printf("%-17s %-9s %10s\n", getPageSizeName(requested), "", "unavailable");
+			continue;
+		}
 		
-#pragma omp for schedule(dynamic, 1) 
-		for (int y = 0; y < height; y++) // y axis of the image	
+		for (int stream = 0; stream < 2; stream++)
 		{
-			int yw = y * width;
-			_yf = _mm512_set1_ps((float) y);
+			// first touch by the rows, the order colorizeFrame() goes through them in
+			Color3f *frameBuffer = allocateFrameBuffer(width, height, Placement::FirstTouch, nThreads, 0, pageSize);
+			colorizeFrame(frameBuffer, itrBuffer.data(), nullptr, width, height, nThreads, lut, nullptr, stream); // warm-up
 			
-			for (int x = 0; x < width; x += 16) // x axis of the image
+			std::vector<double> timeMSec;
+			for (int i = 0; i < REPETITIONS; i++)
 			{
-				_xf = _mm512_setr_ps((float)x + 15, (float)x + 14, (float)x + 13, (float)x + 12,
-				                    (float)x + 11, (float)x + 10, (float)x + 9, (float)x + 8, 
-									(float)x + 7, (float)x + 6, (float)x + 5, (float)x + 4,
-									(float)x + 3, (float)x + 2, (float)x + 1, (float)x);
-
-				// int index = y * width + x;			
-				int index0 = yw + x;
-				int index1 = yw + x + 1;
-				int index2 = yw + x + 2;
-				int index3 = yw + x + 3;		
-				int index4 = yw + x + 4;
-				int index5 = yw + x + 5;
-				int index6 = yw + x + 6;
-				int index7 = yw + x + 7;
-				int index8 = yw + x + 8;
-				int index9 = yw + x + 9;
-				int index10 = yw + x + 10;
-				int index11 = yw + x + 11;
-				int index12 = yw + x + 12;
-				int index13 = yw + x + 13;
-				int index14 = yw + x + 14;
-				int index15 = yw + x + 15;
-
-				// int itr = 0;	
-				_itr = _mm512_set1_epi32(0); // initialize iteration counter for each pixel
-
-				// float zr = 0, zi = 0, cr = 0, ci = 0; [ Complex z, c ]				
-				_zr = _mm512_set1_ps(0);
-				_zi = _mm512_set1_ps(0);
-				_cr = _mm512_set1_ps(0);
-				_ci = _mm512_set1_ps(0);
-
-				// getMappedScaleX(const int &x, const int &xMax)
-
-				// cr = (x * invW) - 2.5;			
-				_cr = _mm512_fmadd_ps(_xf, _invw, _const2p5neg);
-
-
-				// getMappedScaleY(const int &y, const int &yMax)
-
-				// ci = (y * invH) - 1;			
-				_ci = _mm512_fmadd_ps(_yf, _invh, _const1neg);
-
-
-				///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
-
-			loop: // while (...)
-
-				_zr2 = _mm512_mul_ps(_zr, _zr); // zr * zr
-				_zi2 = _mm512_mul_ps(_zi, _zi); // zi * zi
-				_mod = _mm512_add_ps(_zr2, _zi2); // zr * zr + zi * zi			
-
-				__mmask16 _masknumitr = _mm512_cmplt_epi32_mask(_itr, _constmaxitr);   // itr < MAX_ITR
-				__mmask16 _maskradius = _mm512_cmple_ps_mask(_mod, _const4); // zr * zr + zi * zi <= 4.0
-				
-				__mmask16 _whileTrue = _maskradius & _masknumitr; // (zr * zr + zi * zi <= 4.0 && itr < MAX_ITR)
-
-				//////////////////////// evalMandel(z, c)//////////////////////////////////
-
-				_a = _zr;
-				_b = _zi;
-
-				_zr = _mm512_sub_ps(_zr2, _zi2); // zr = zr * zr - zi * zi
-				_zr = _mm512_add_ps(_zr, _cr); // zr += cr
-
-				_zi = _mm512_mul_ps(_a, _b); // zi = a * b
-
-				// zi = zi * 2 + ci
-				_zi = _mm512_fmadd_ps(_zi, _const2, _ci);
-
-				//////////////////////// evalMandel(z, c)//////////////////////////////////
-
-
-				// itr++;
-
-				__m512i _zero = _mm512_setzero_epi32();
-				__m512i _onlytrue = _mm512_mask_set1_epi32(_zero, _whileTrue, 1);
-
-				_inc1i = _mm512_and_si512(_onlytrue, _const1i);
-				_itr = _mm512_add_epi32(_itr, _inc1i);
-
-				// if (any one register satisfies while condition) goto loop;
-				if (_mm512_mask2int(_whileTrue))
-					goto loop;
-
-				///////////////////////////// while (zr * zr + zi * zi <= 2 * 2 && itr < MAX_ITR) ///////////////////////////////
-
-				// if (itr < MAX_ITR) frameBuffer[index] = BLACK;
-				// else frameBuffer[index] = CYAN;
-
-
-				// pixel masks read in correct endianness |...7, 6, 5, 4, 3, 2, 1, 0| instead of |0, 1, 2, 3, 4, 5, 6, 7...| 			
-				int pixel0 = _masknumitr & (1 << 15);
-				int pixel1 = _masknumitr & (1 << 14);
-				int pixel2 = _masknumitr & (1 << 13);
-				int pixel3 = _masknumitr & (1 << 12);
-				int pixel4 = _masknumitr & (1 << 11);
-				int pixel5 = _masknumitr & (1 << 10);
-				int pixel6 = _masknumitr & (1 << 9);
-				int pixel7 = _masknumitr & (1 << 8);
-				int pixel8 = _masknumitr & (1 << 7);
-				int pixel9 = _masknumitr & (1 << 6);
-				int pixel10 = _masknumitr & (1 << 5);
-				int pixel11 = _masknumitr & (1 << 4);
-				int pixel12 = _masknumitr & (1 << 3);
-				int pixel13 = _masknumitr & (1 << 2);
-				int pixel14 = _masknumitr & (1 << 1);
-				int pixel15 = _masknumitr & 1;
-
-				frameBuffer[index0] = pixel0 ? BLACK : CYAN;
-				frameBuffer[index1] = pixel1 ? BLACK : CYAN;
-				frameBuffer[index2] = pixel2 ? BLACK : CYAN;
-				frameBuffer[index3] = pixel3 ? BLACK : CYAN;
-				frameBuffer[index4] = pixel4 ? BLACK : CYAN;
-				frameBuffer[index5] = pixel5 ? BLACK : CYAN;
-				frameBuffer[index6] = pixel6 ? BLACK : CYAN;
-				frameBuffer[index7] = pixel7 ? BLACK : CYAN;
-				frameBuffer[index8] = pixel8 ? BLACK : CYAN;
-				frameBuffer[index9] = pixel9 ? BLACK : CYAN;
-				frameBuffer[index10] = pixel10 ? BLACK : CYAN;
-				frameBuffer[index11] = pixel11 ? BLACK : CYAN;
-				frameBuffer[index12] = pixel12 ? BLACK : CYAN;
-				frameBuffer[index13] = pixel13 ? BLACK : CYAN;
-				frameBuffer[index14] = pixel14 ? BLACK : CYAN;
-				frameBuffer[index15] = pixel15 ? BLACK : CYAN;
+				auto start = std::chrono::high_resolution_clock::now();
+				colorizeFrame(frameBuffer, itrBuffer.data(), nullptr, width, height, nThreads, lut, nullptr, stream);
+				auto stop = std::chrono::high_resolution_clock::now();
+				timeMSec.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
 			}
+			std::sort(timeMSec.begin(), timeMSec.end());
+			
+			for (int counter : { loadCounter, storeCounter })
+			{
+				if (counter >= 0)
+				{
+					ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+					ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+				}
+			}
+			colorizeFrame(frameBuffer, itrBuffer.data(), nullptr, width, height, 1, lut, nullptr, stream);
+			std::string loadMisses = countMisses(loadCounter), storeMisses = countMisses(storeCounter);
+			
+			std::printf("%-17s %-9s %10.2f %18s %18s\n", getPageSizeName(pageSize), stream ? "streaming" : "regular",
+						frameGB / (timeMSec[REPETITIONS / 2] / 1e3), loadMisses.c_str(), storeMisses.c_str());
+			freeFrameBuffer(frameBuffer, width, height);
 		}
 	}
+	
+	if (loadCounter >= 0)
+		close(loadCounter);
+	if (storeCounter >= 0)
+		close(storeCounter);
 }
 
-#endif // ISA_AVX512
+/*=====================================================================*/
+
+/*=========================== VERIFICATION ===========================*/
 
-/////////////////////////////////////////////// AVX-512 END /////////////////////////////////////////////
+// Renders the current view with every kernel the processor supports and compares the iteration count of every pixel
+// with the one of the scalar kernel of the same precision. For every kernel it prints the number of mismatched
+// pixels, the largest difference and the VERIFY_REGION x VERIFY_REGION region with the most mismatches. Returns the
+// total number of mismatched pixels. The SIMD kernels only match bit for bit when built with -DSTRICT_FP, otherwise
+// the pixels they map and iterate with FMAs can come out differently near the boundary of the set.
 
-/********************************************INTRINSICS END*******************************************/
+const int VERIFY_REGION = 32;
 
-void drawMandelbrot(Color3f *frameBuffer, const int &width, const int &height)
+uint64_t verifyBackends(int width, int height, SIMDISA isa)
 {
-	uint32_t index = 0;
-	for (int y = 0; y < height; y++) // y axis of the image	
+	struct Backend
 	{
-		for (int x = 0; x < width; x++) // x axis of the image
+		const char *name;
+		CountKernel countSpan;
+		SIMDISA required; // SIMDISA::None marks the scalar reference of the kernels listed after it
+	};
+	
+	const Backend backends[] = {
+		{ "scalar", countSpan, SIMDISA::None },
+		{ "sse", countSpanSSE, SIMDISA::SSE },
+		{ "avx", countSpanAVX, SIMDISA::AVX },
+		{ "avx512", countSpanAVX512, SIMDISA::AVX512 },
+		{ "scalar double", countSpanDouble, SIMDISA::None },
+		{ "avx double", countSpanAVXDouble, SIMDISA::AVX },
+		{ "avx512 double", countSpanAVX512Double, SIMDISA::AVX512 }
+	};
+	
+	const uint32_t nThreads = std::thread::hardware_concurrency();
+	const size_t bufferSize = static_cast<size_t>(width) * height;
+	std::vector<uint32_t> reference(bufferSize), counts(bufferSize);
+	
+	const int regionsX = (width + VERIFY_REGION - 1) / VERIFY_REGION, regionsY = (height + VERIFY_REGION - 1) / VERIFY_REGION;
+	std::vector<uint32_t> regionMismatches(static_cast<size_t>(regionsX) * regionsY);
+	
+#ifdef STRICT_FP
+	const char *evaluation = "strict";
+#else
+	const char *evaluation = "fast (build with -DSTRICT_FP for bit-exact kernels)";
+#endif
+	std::cout << "Verifying the kernels at " << width << " x " << height << ", " << MAX_ITR << " iterations, " << getISAName(isa)
+			  << ", " << evaluation << " evaluation\n\n";
+	std::printf("%-14s %12s %9s %9s  %s\n", "Backend", "Mismatches", "Share", "Max diff", "Worst region");
+	
+	uint64_t totalMismatches = 0;
+	for (const Backend &backend : backends)
+	{
+		if (isa < backend.required)
 		{
-			index = y * width + x;
-			int itr = 0;
-			Complex z, c;
-			c.a = getMappedScaleX((float)x, width);
-			c.b = getMappedScaleY((float)y, height);
-			while (z.real() * z.real() + z.imaginary() * z.imaginary() <= 2 * 2 && itr < MAX_ITR)
+			std::printf("%-14s %12s\n", backend.name, "unsupported");
+			continue;
+		}
+		
+		const bool isReference = (backend.required == SIMDISA::None);
+		countMandelbrotOMPSpans(isReference ? reference.data() : counts.data(), nullptr, width, height, nThreads, backend.countSpan);
+		if (isReference)
+		{
+			std::printf("%-14s %12s\n", backend.name, "reference");
+			continue;
+		}
+		
+		uint64_t mismatches = 0;
+		uint32_t maxDiff = 0;
+		std::fill(regionMismatches.begin(), regionMismatches.end(), 0);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
 			{
-				evalMandel(z, c);
-				itr++;
+				size_t index = static_cast<size_t>(y) * width + x;
+				if (counts[index] == reference[index])
+					continue;
+				
+				mismatches++;
+				maxDiff = std::max(maxDiff, std::max(counts[index], reference[index]) - std::min(counts[index], reference[index]));
+				regionMismatches[(y / VERIFY_REGION) * regionsX + x / VERIFY_REGION]++;
 			}
-			if (itr < MAX_ITR)
-				frameBuffer[index] = BLACK;
-			else
-				frameBuffer[index] = CYAN;
 		}
+		totalMismatches += mismatches;
+		
+		std::printf("%-14s %12llu %8.4f%% %9u", backend.name, static_cast<unsigned long long>(mismatches), 100.0 * mismatches / bufferSize, maxDiff);
+		if (mismatches)
+		{
+			size_t worst = std::max_element(regionMismatches.begin(), regionMismatches.end()) - regionMismatches.begin();
+			int x0 = static_cast<int>(worst % regionsX) * VERIFY_REGION, y0 = static_cast<int>(worst / regionsX) * VERIFY_REGION;
+			int x1 = std::min(x0 + VERIFY_REGION, width), y1 = std::min(y0 + VERIFY_REGION, height);
+			std::printf("  %u pixels in (%d, %d) - (%d, %d), around %.8g %+.8gi", regionMismatches[worst], x0, y0, x1 - 1, y1 - 1,
+						view.getMinX() + (x0 + x1) / 2.0 / width * view.getWidth(), view.getMinY() + (y0 + y1) / 2.0 / height * view.getHeight());
+		}
+		std::printf("\n");
 	}
+	
+	return totalMismatches;
 }
 
-void drawMandelbrotOMP(Color3f* frameBuffer, const int &width, const int &height)
-{
-	size_t nThreads = std::thread::hardware_concurrency();
-#pragma omp parallel num_threads(nThreads) shared(frameBuffer)
+int main(int argc, char **argv)
+{	
+	const SIMDISA isa = detectISA();
+	const SIMDKernel drawMandelbrotSIMD = getSIMDKernel(isa);
+	
+	// usage: --farm workers [width height iterations [threads per worker]]
+	if (argc > 2 && std::string(argv[1]) == "--farm")
 	{
-#pragma omp for schedule(dynamic, 1) 
-		for (int y = 0; y < height; y++) // y axis of the image	
+		int numWorkers = std::atoi(argv[2]);
+		int width = (argc > 5) ? std::atoi(argv[3]) : 1024, height = (argc > 5) ? std::atoi(argv[4]) : 768;
+		MAX_ITR = (argc > 5) ? std::atoi(argv[5]) : 1000;
+		int nThreads = (argc > 6) ? std::atoi(argv[6]) : 1;
+		
+		if (numWorkers < 1 || nThreads < 1 || width < 1 || height < 1)
 		{
-			for (int x = 0; x < width; x++) // x axis of the image
-			{
-				uint32_t index = y * width + x;
-				int itr = 0;
-				Complex z, c;
-				c.a = getMappedScaleX((float)x, width);
-				c.b = getMappedScaleY((float)y, height);
-				while (z.real() * z.real() + z.imaginary() * z.imaginary() <= 2 * 2 && itr < MAX_ITR)
-				{
-					evalMandel(z, c);
-					itr++;
-				}
-				if (itr < MAX_ITR)
-					frameBuffer[index] = BLACK;
-				else
-					frameBuffer[index] = CYAN;
-			}
+			std::cout << "Invalid number of workers, threads or resolution! Aborting...\n";
+			std::exit(EXIT_FAILURE);
 		}
+		
+		std::cout << "Rendering " << width << " x " << height << " with " << numWorkers << " worker processes of " << nThreads << " threads...\n";
+		IterationBuffer<uint32_t> counts;
+		counts.resize(width, height, false);
+		
+		auto start = std::chrono::high_resolution_clock::now();
+		countMandelbrotFarm(counts.itr.data(), width, height, numWorkers, nThreads);
+		auto stop = std::chrono::high_resolution_clock::now();
+		std::cout << "Time taken is " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << " milliseconds.\n";
+		
+		// the workers only count, the master colors the frame once it has all the rows
+		std::vector<Color3f> frameBuffer(counts.itr.size());
+		colorMandelbrotDeferred(frameBuffer.data(), counts, std::thread::hardware_concurrency(), PALETTES[0], false);
+		saveImgP6(frameBuffer.data(), width, height);
+		return 0;
 	}
-}
-
-void drawMandelbrotThread(int renderWidth, int renderHeight, int tileWidth, int tileHeight, int startX, int startY, Color3f *frameBuffer)
-{
-	for (int y = 0; y < tileHeight; y++) // y axis of the image	
+	
+	if (argc > 2 && std::string(argv[1]) == "--farm-worker")
+		return runFarmWorker(std::atoi(argv[2]));
+	
+	// usage: --verify [width height iterations [centerX centerY zoom]]
+	if (argc > 1 && std::string(argv[1]) == "--verify")
 	{
-		for (int x = startX; x < tileWidth; x++) // x axis of the image
+		int width = (argc > 4) ? std::atoi(argv[2]) : 1024, height = (argc > 4) ? std::atoi(argv[3]) : 768;
+		MAX_ITR = (argc > 4) ? std::atoi(argv[4]) : 1000;
+		if (argc > 7)
 		{
-			uint32_t index = (startY + y) * tileWidth + x;
-			int itr = 0;
-			Complex z, c;
-			c.a = getMappedScaleX((float)x, renderWidth);
-			c.b = getMappedScaleY((float)(startY + y), renderHeight);
-			while (z.real() * z.real() + z.imaginary() * z.imaginary() <= 2 * 2 && itr < MAX_ITR)
-			{
-				evalMandel(z, c);
-				itr++;
-			}
-			if (itr < MAX_ITR)
-				frameBuffer[index] = BLACK;
-			else
-				frameBuffer[index] = CYAN;
+			view.centerX = parseDoubleDouble(argv[5]);
+			view.centerY = parseDoubleDouble(argv[6]);
+			view.scale = std::atof(argv[7]);
+		}
+		
+		if (width < 1 || height < 1 || !(view.scale > 0))
+		{
+			std::cout << "Invalid resolution or zoom factor! Aborting...\n";
+			std::exit(EXIT_FAILURE);
 		}
+		
+		return verifyBackends(width, height, isa) ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
-}
-
-void drawMandelbrotMT(Color3f *frameBuffer, const int &width, const int &height)
-{
-	uint32_t startX = 0, startY = 0; 
-	size_t nThreads = std::thread::hardware_concurrency();
 	
-	size_t tileWidth = width, tileHeight = height / nThreads;
+	// usage: --benchmark-interior [width height iterations]
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-interior")
+	{
+		int width = (argc > 4) ? std::atoi(argv[2]) : 1024, height = (argc > 4) ? std::atoi(argv[3]) : 768;
+		MAX_ITR = (argc > 4) ? std::atoi(argv[4]) : 10000;
+		benchmarkInteriorChecks(width, height, isa);
+		return 0;
+	}
 	
-	std::thread *mandelThreads = new std::thread[nThreads];
-	for (int i = 0; i < nThreads - 1; ++i)
+	if (argc > 1 && std::string(argv[1]) == "--benchmark")
 	{
-		mandelThreads[i] = std::thread(drawMandelbrotThread, width, height, tileWidth, tileHeight, startX, startY, frameBuffer);
-		startY += tileHeight;
+		runBenchmark(parseBenchmarkOptions(argc, argv), isa);
+		return 0;
 	}
-	mandelThreads[nThreads - 1] = std::thread(drawMandelbrotThread, width, height, tileWidth, height - startY, startX, startY, frameBuffer);
 	
-	for (int i = 0; i < nThreads; ++i)
-		mandelThreads[i].join();
+	// usage: --benchmark-memory [width height]
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-memory")
+	{
+		int width = (argc > 3) ? std::atoi(argv[2]) : 7680, height = (argc > 3) ? std::atoi(argv[3]) : 4320;
+		MAX_ITR = 1000;
+		benchmarkFrameMemory(width, height, isa);
+		return 0;
+	}
 	
-	delete [] mandelThreads;
-}
-
-bool isValidISA()
-{
-
-#if defined(ISA_SSE) && defined(ISA_AVX) && defined(ISA_AVX512)
-	return false;
-#endif
-
-	uint32_t flag = 0;
-
-#ifdef ISA_SSE
-	flag ^= 1;
-#endif
-
-#ifdef ISA_AVX
-	flag ^= 1;
-#endif
-
-#ifdef ISA_AVX512
-	flag ^= 1;
-#endif
-
-	return (flag & 1);
-}
-
-int main()
-{	
-	if (!isValidISA())
+	// usage: --benchmark-mt [width height iterations]
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-mt")
 	{
-		std::cerr << "Invalid compilation flags detected in binary. Aborting..." << std::endl;
-		std::exit(EXIT_FAILURE);
+		int width = (argc > 4) ? std::atoi(argv[2]) : 1920, height = (argc > 4) ? std::atoi(argv[3]) : 1080;
+		MAX_ITR = (argc > 4) ? std::atoi(argv[4]) : 1000;
+		benchmarkWorkStealing(width, height);
+		return 0;
 	}
 	
-	int width = 0, height = 0, saveRender = 0, useSIMD = 0;
+	// usage: --animate keyframes.txt frames [width height iterations [prefix]]
+	if (argc > 3 && std::string(argv[1]) == "--animate")
+	{
+		int numFrames = std::atoi(argv[3]);
+		int width = (argc > 6) ? std::atoi(argv[4]) : 1024, height = (argc > 6) ? std::atoi(argv[5]) : 768;
+		MAX_ITR = (argc > 6) ? std::atoi(argv[6]) : 1000;
+		std::string prefix = (argc > 7) ? argv[7] : "Mandelbrot";
+		
+		if (numFrames < 1 || width < 1 || height < 1)
+		{
+			std::cout << "Invalid number of frames or resolution! Aborting...\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		interiorChecks = true; // only skips work, the frames are the same
+		std::cout << "Rendering " << numFrames << " frames at " << width << " x " << height << " using " << getISAName(isa) << "...\n";
+		renderAnimation(loadKeyframes(argv[2]), numFrames, width, height, isa, prefix);
+		return 0;
+	}
+	
+	int width = 0, height = 0, saveRender = 0, useSIMD = 0, useTiles = 0, customView = 0, useSubdivision = 0, useProgressive = 0;
+	int colorPass = 0, paletteIndex = 0, numSubSamples = 0, edgeThreshold = -1, fractalIndex = 0;
 	char ch = ' ';	
 	std::cout << "This program renders the Mandelbrot set in a non real-time context.\n";
 	std::cout << "Please enter the desired resolution in pixels. Width (then press return), followed by height (press return).\n";
@@ -840,18 +4434,225 @@ int main()
 	std::cin >> height;
 	std::cout << "Please enter the desired number of iterations to calculate the Mandelbrot set.\n";
 	std::cin >> MAX_ITR;
+	std::cout << "Which fractal? (0 = Mandelbrot set[default] / 1 = Julia set / 2 = Burning Ship / 3 = Multibrot set)\n";
+	std::cin >> fractalIndex;
+	
+	if (fractalIndex == 1)
+	{
+		fractal.type = FractalType::Julia;
+		std::cout << "Please enter the real and the imaginary part of the constant C of the Julia set.\n";
+		std::cin >> fractal.juliaR >> fractal.juliaI;
+		view.centerX = 0;
+		view.scale = 0.8;
+	}
+	else if (fractalIndex == 2)
+	{
+		// the set lies mostly below the real axis, and the rows run downwards from the top of the view
+		fractal.type = FractalType::BurningShip;
+		view.centerX = -0.5;
+		view.centerY = -0.5;
+		view.scale = 0.8;
+	}
+	else if (fractalIndex == 3)
+	{
+		fractal.type = FractalType::Multibrot;
+		std::cout << "Please enter the power of Z (2 or more).\n";
+		std::cin >> fractal.power;
+		view.centerX = 0;
+		view.scale = 0.75;
+		
+		if (fractal.power < 2)
+		{
+			std::cout << "Invalid power! Aborting...\n";
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	else if (fractalIndex != 0)
+	{
+		std::cout << "Invalid fractal! Aborting...\n";
+		std::exit(EXIT_FAILURE);
+	}
+	
+	std::cout << "Skip the iterations of points known to be inside the set? Much faster at high iteration counts. (1 = Yes / 0 = No[default])\n";
+	std::cin >> interiorChecks;
+	std::cout << "Zoom into a custom view? (1 = Yes / 0 = No[default])\n";
+	std::cin >> customView;
+	
+	if (customView)
+	{
+		std::string centerX, centerY;
+		std::cout << "Please enter the real and the imaginary part of the center of the view, followed by the zoom factor (1 = whole set).\n";
+		std::cin >> centerX >> centerY >> view.scale;
+		view.centerX = parseDoubleDouble(centerX);
+		view.centerY = parseDoubleDouble(centerY);
+		
+		if (!(view.scale > 0))
+		{
+			std::cout << "Invalid zoom factor! Aborting...\n";
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	
+	const Precision precision = getRequiredPrecision(width);
+	if (precision == Precision::Perturbation)
+		computeReferenceOrbit();
+	
 	std::cout << "Number of logical processors detected: " << std::thread::hardware_concurrency() << std::endl;
+	std::cout << "Widest SIMD instruction set detected: " << getISAName(isa) << std::endl;
+	std::cout << "Arithmetic required for this zoom: " << getPrecisionName(precision) << std::endl;
+	std::cout << "Render tile by tile straight to disk? Recommended for very large frames. (1 = Yes / 0 = No[default])\n";
+	std::cin >> useTiles;
+	
+	if (useTiles)
+	{
+		std::cout << "Generating the " << getFractalName(fractal.type) << " in " << TILE_SIZE << " x " << TILE_SIZE << " tiles using " << getISAName(isa) << "...\n";
+		auto start = std::chrono::high_resolution_clock::now();
+		drawMandelbrotTiled(width, height, TILE_SIZE, std::thread::hardware_concurrency(), getSpanKernel(isa, precision));
+		auto stop = std::chrono::high_resolution_clock::now();
+		std::cout << "Time taken is " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << " milliseconds.\n";
+		return 0;
+	}
+	
 	std::cout << "Enable multithreading? (Y/N)\n";
 	std::cin >> ch;
-	std::cout << "Save rendered output? (1 = Yes / 0 = No[default])\n";
+	
+	const bool multithreaded = (ch == 'y' || ch == 'Y');
+	if (multithreaded)
+	{
+		std::cout << "Pin the render threads to logical processors? Keeps the frame on the NUMA nodes rendering it. (1 = Yes / 0 = No[default])\n";
+		std::cin >> pinThreads;
+	}
+	
+	std::cout << "Save rendered output? (0 = No[default] / 1 = Text PPM / 2 = Binary PPM / 3 = Binary PPM streamed while rendering)\n";
 	std::cin >> saveRender;
+	std::cout << "Skip uniform regions using recursive subdivision (Mariani-Silver)? (1 = Yes / 0 = No[default])\n";
+	std::cin >> useSubdivision;
+	
+	if (!useSubdivision)
+	{
+		std::cout << "Render progressively, starting with a coarse preview? (1 = Yes / 0 = No[default])\n";
+		std::cin >> useProgressive;
+	}
+	
+	if (!useSubdivision && !useProgressive)
+	{
+		std::cout << "Store iteration counts and color them in a separate pass? (0 = No[default] / 1 = Yes / 2 = Yes, with smooth coloring /\n"
+				  << "3 = Yes, histogram equalized / 4 = Yes, histogram equalized with smooth coloring)\n";
+		std::cin >> colorPass;
+		
+		if (colorPass < 0 || colorPass > 4)
+		{
+			std::cout << "Invalid choice! Aborting...\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		if (colorPass)
+		{
+			std::cout << "Choose a palette (0 = Classic[default] / 1 = Fire / 2 = Ocean)\n";
+			std::cin >> paletteIndex;
+			
+			if (paletteIndex < 0 || paletteIndex >= static_cast<int>(sizeof(PALETTES) / sizeof(PALETTES[0])))
+			{
+				std::cout << "Invalid choice! Aborting...\n";
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		else if (precision == Precision::Single)
+		{
+			std::cout << "Anti-alias with k x k sub-samples per pixel? (Enter k, 1 = No[default])\n";
+			std::cin >> numSubSamples;
+			
+			if (numSubSamples > 1)
+			{
+				std::cout << "Only supersample pixels whose iteration count differs from a neighbour's by more than: (-1 = Supersample all pixels)\n";
+				std::cin >> edgeThreshold;
+			}
+		}
+	}
 	
+	// pinned threads first touch the rows they render, unpinned ones could be anywhere so the pages are interleaved
 	int bufferSize = width * height;
-	Color3f *frameBuffer = new Color3f[bufferSize];	
+	const Placement placement = (pinThreads || !multithreaded) ? Placement::FirstTouch : Placement::Interleave;
+	PinnedThreads pinnedThreads(std::thread::hardware_concurrency(), multithreaded && pinThreads);
+	Color3f *frameBuffer = allocateFrameBuffer(width, height, placement, multithreaded ? std::thread::hardware_concurrency() : 1);
+	
+	// finished rows are written out in the background while the rest of the frame renders
+	std::unique_ptr<PPMStreamWriter> streamWriter;
+	RowCallback onRowDone;
+	if (saveRender == 3)
+	{
+		std::cout << "Streaming rendered rows to file..." << std::endl;
+		streamWriter.reset(new PPMStreamWriter(width, height));
+		onRowDone = [&](int y) { streamWriter->pushRow(y, frameBuffer + y * width); };
+	}
 
 	std::chrono::time_point<std::chrono::high_resolution_clock> start, stop;
 	
-	if (ch == 'y' || ch == 'Y')
+	// the counts of a separate color pass, 16 bits per pixel whenever MAX_ITR fits
+	IterationBuffer<uint16_t> counts16;
+	IterationBuffer<uint32_t> counts32;
+	
+	if (useSubdivision)
+	{
+		std::cout << "Generating the " << getFractalName(fractal.type) << " by recursive subdivision in " << getPrecisionName(precision) << " using "
+				  << getISAName(isa) << "...\n";
+		uint32_t nThreads = (ch == 'y' || ch == 'Y') ? std::thread::hardware_concurrency() : 1;
+		start = std::chrono::high_resolution_clock::now();
+		// only the AVX and AVX-512 sample kernels map the points like their count kernels
+		const bool hasSamples = precision == Precision::Single && (isa == SIMDISA::AVX || isa == SIMDISA::AVX512);
+		uint64_t numEvaluated = drawMandelbrotMarianiSilver(frameBuffer, width, height, nThreads, getCountKernel(isa, precision),
+															hasSamples ? getSampleKernel(isa) : nullptr, onRowDone);
+		stop = std::chrono::high_resolution_clock::now();
+		std::cout << "Evaluated " << numEvaluated << " of " << bufferSize << " pixels ("
+				  << static_cast<double>(bufferSize) / numEvaluated << "x fewer).\n";
+	}
+	else if (useProgressive)
+	{
+		std::cout << "Generating the " << getFractalName(fractal.type) << " progressively using " << getISAName(isa) << "...\n";
+		uint32_t nThreads = (ch == 'y' || ch == 'Y') ? std::thread::hardware_concurrency() : 1;
+		start = std::chrono::high_resolution_clock::now();
+		drawMandelbrotProgressive(frameBuffer, width, height, nThreads, getSpanKernel(isa, precision), [&](const Color3f *, int pass, int step) {
+			auto now = std::chrono::high_resolution_clock::now();
+			std::cout << "Pass " << pass << " (row step " << step << ") ready after "
+					  << std::chrono::duration_cast<std::chrono::microseconds>(now - start).count() / 1000.0 << " milliseconds.\n";
+		}, onRowDone);
+		stop = std::chrono::high_resolution_clock::now();
+	}
+	else if (numSubSamples > 1)
+	{
+		std::cout << "Generating the " << getFractalName(fractal.type) << " with " << numSubSamples << " x " << numSubSamples << " sub-samples using " << getISAName(isa) << "...\n";
+		uint32_t nThreads = (ch == 'y' || ch == 'Y') ? std::thread::hardware_concurrency() : 1;
+		start = std::chrono::high_resolution_clock::now();
+		uint64_t numSupersampled = drawMandelbrotSupersampled(frameBuffer, width, height, nThreads, numSubSamples, edgeThreshold,
+															  getCountKernel(isa), getSampleKernel(isa), onRowDone);
+		stop = std::chrono::high_resolution_clock::now();
+		std::cout << "Supersampled " << numSupersampled << " of " << bufferSize << " pixels.\n";
+	}
+	else if (colorPass)
+	{
+		std::cout << "Generating the " << getFractalName(fractal.type) << " in " << getPrecisionName(precision) << " using " << getISAName(isa) << "...\n";
+		uint32_t nThreads = (ch == 'y' || ch == 'Y') ? std::thread::hardware_concurrency() : 1;
+		start = std::chrono::high_resolution_clock::now();
+		
+		if (MAX_ITR <= UINT16_MAX)
+			drawMandelbrotDeferred(frameBuffer, counts16, width, height, nThreads, getCountKernel(isa, precision), colorPass % 2 == 0, colorPass >= 3,
+								   PALETTES[paletteIndex], onRowDone);
+		else
+			drawMandelbrotDeferred(frameBuffer, counts32, width, height, nThreads, getCountKernel(isa, precision), colorPass % 2 == 0, colorPass >= 3,
+								   PALETTES[paletteIndex], onRowDone);
+		
+		stop = std::chrono::high_resolution_clock::now();
+	}
+	else if (precision != Precision::Single)
+	{
+		// only the span kernels come in double precision, so they are used regardless of the remaining choices
+		std::cout << "Generating the " << getFractalName(fractal.type) << " in " << getPrecisionName(precision) << "...\n";
+		uint32_t nThreads = (ch == 'y' || ch == 'Y') ? std::thread::hardware_concurrency() : 1;
+		start = std::chrono::high_resolution_clock::now();
+		drawMandelbrotOMPSpans(frameBuffer, width, height, nThreads, getSpanKernel(isa, precision, !onRowDone), onRowDone);
+		stop = std::chrono::high_resolution_clock::now();
+	}
+	else if (ch == 'y' || ch == 'Y')
 	{		
 		std::cout << "Use OpenMP? (Y/N)\n";
 		std::cin >> ch;
@@ -860,60 +4661,56 @@ int main()
 			std::cout << "Use SIMD for better performance? (1 = Yes / 0 = No[default])\n";
 			std::cin >> useSIMD;
 			std::cout << "Using OpenMP for parallelism.\n";
-			std::cout << "Generating the Mandelbrot set...\n";
+			std::cout << "Generating the " << getFractalName(fractal.type) << "...\n";
 			start = std::chrono::high_resolution_clock::now();
 			
 			if (useSIMD)
 			{
-#if ISA_SSE
-				drawMandelbrotOMPSSE(frameBuffer, width, height, std::thread::hardware_concurrency());
-#elif ISA_AVX
-				drawMandelbrotOMPAVX(frameBuffer, width, height, std::thread::hardware_concurrency());
-#elif ISA_AVX512
-				drawMandelbrotOMPAVX512(frameBuffer, width, height, std::thread::hardware_concurrency());
-#else
-				std::cerr << "Compilation error. Please specify the correct instruction set architecture "
-                             "during compilation. Please see the documentation in the source file. Aborting..." << std::endl;
-				std::exit(1);
-#endif
+				if (!drawMandelbrotSIMD)
+				{
+					std::cerr << "No supported SIMD instruction set was found on this processor. Aborting..." << std::endl;
+					std::exit(EXIT_FAILURE);
+				}
+				drawMandelbrotSIMD(frameBuffer, width, height, std::thread::hardware_concurrency(), onRowDone);
 			}
 			else
-				drawMandelbrotOMP(frameBuffer, width, height);
+				drawMandelbrotOMP(frameBuffer, width, height, std::thread::hardware_concurrency(), onRowDone);
 			
 			stop = std::chrono::high_resolution_clock::now();
 		}
 		else
 		{
 			std::cout << "Using STL threads for parallelism.\n";
-			std::cout << "Generating the Mandelbrot set...\n";
+			std::cout << "Generating the " << getFractalName(fractal.type) << "...\n";
+			
+			// the rows were first touched for the OpenMP renderers, the STL threads start out with bands of tiles instead
+			freeFrameBuffer(frameBuffer, width, height);
+			frameBuffer = allocateFrameBuffer(width, height, placement, std::thread::hardware_concurrency(), MT_TILE_SIZE);
 			start = std::chrono::high_resolution_clock::now();
-			drawMandelbrotMT(frameBuffer, width, height);	
-			stop = std::chrono::high_resolution_clock::now();			
+			std::vector<ThreadStats> threadStats;
+			drawMandelbrotMT(frameBuffer, width, height, std::thread::hardware_concurrency(), onRowDone, &threadStats);	
+			stop = std::chrono::high_resolution_clock::now();
+			printThreadStats(threadStats);
 		}
 	}		
 	else if ((ch == 'n' || ch == 'N'))
 	{
 		std::cout << "Use SIMD for better performance? (1 = Yes / 0 = No[default])\n";
 		std::cin >> useSIMD;
-		std::cout << "Generating the Mandelbrot set...\n";
+		std::cout << "Generating the " << getFractalName(fractal.type) << "...\n";
 		start = std::chrono::high_resolution_clock::now();
 		
 		if (useSIMD)
 		{	
-#if ISA_SSE
-				drawMandelbrotOMPSSE(frameBuffer, width, height, 1);
-#elif ISA_AVX
-				drawMandelbrotOMPAVX(frameBuffer, width, height, 1);
-#elif ISA_AVX512
-				drawMandelbrotOMPAVX512(frameBuffer, width, height, 1);
-#else
-				std::cerr << "Compilation error. Please specify the correct instruction set architecture "
-                             "during compilation. Please see the documentation in the source file. Aborting..." << std::endl;
-				std::exit(1);
-#endif
+			if (!drawMandelbrotSIMD)
+			{
+				std::cerr << "No supported SIMD instruction set was found on this processor. Aborting..." << std::endl;
+				std::exit(EXIT_FAILURE);
+			}
+			drawMandelbrotSIMD(frameBuffer, width, height, 1, onRowDone);
 		}
 		else
-			drawMandelbrot(frameBuffer, width, height);
+			drawMandelbrot(frameBuffer, width, height, onRowDone);
 		
 		stop = std::chrono::high_resolution_clock::now();
 	}
@@ -923,6 +4720,8 @@ int main()
 		std::exit(EXIT_FAILURE);
 	}
 	
+	pinnedThreads.restore();
+	
 	auto diffMSec = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
 	auto diffSec = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
 	
@@ -931,9 +4730,13 @@ int main()
 	else
 		std::cout << "Time taken is " << (int)diffSec.count() << " seconds.\n";
 
-	if (saveRender)
+	if (streamWriter)
+		streamWriter->finish();
+	else if (saveRender == 1)
 		saveImg(frameBuffer, width, height);
+	else if (saveRender == 2)
+		saveImgP6(frameBuffer, width, height);
 	
-	delete[] frameBuffer;
+	freeFrameBuffer(frameBuffer, width, height);
 	return 0;
 }
\ No newline at end of file
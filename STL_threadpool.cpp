@@ -7,18 +7,35 @@ along with the task system that can operate on arbitrary functions as per the us
 Here is the general algorithm of the task system (ThreadPool class):
 
 [1] Initialize the thread pool and wait for tasks.
-[2] User adds tasks to the task queue of the thread pool and notifies the task system.
-[3] The waiting threads check periodically for available tasks.
-[4] If a task (new or partially completed) is available in the queue, they take the task and begin execution.
-[5] If the task execution finishes, the thread goes to the waiting state again.
+[2] User adds tasks to the injection queue of the thread pool and notifies the task system. Tasks added by a running
+    task go to the deque of the thread running it instead.
+[3] The threads look for available tasks, in their own deque first, then in the injection queue, then in the deques
+    of the other threads, from which they steal.
+[4] If a task (new or partially completed) is available, they take the task and begin execution.
+[5] If the task execution finishes, the thread looks for the next task, and goes to the waiting state if there is none.
 [6] If the task execution was interrupted preemptively by the user, the task is moved to the queue of interrupted tasks.
 [7] After step [6], the thread goes to the waiting state again.
-[8] If the user chooses to shutdown the task system, the tasks are interrupted and the threads are joined.
+[8] If the user chooses to shutdown the task system, the queued tasks are either drained (run to completion, within
+    a time limit if given) or cancelled, the running ones are interrupted and the threads are joined. Pause
+    requests made during a drain are ignored, and tasks paused before it are resumed, so that nothing is left parked.
 
 We have a threadpool that spawns N + 2 threads where N is the number of hardware threads available on the system.
 We can add any number of task functions to the queue of the threadpool. If there are more tasks available than 
 there are free threads available in the pool, the remaining tasks wait in the queue until the current batch of
-tasks finish execution.
+tasks finish execution. None of the queues take a lock, so that the threads do not contend on one mutex for every
+task: each thread has a Chase-Lev deque, which only it pushes to and pops from, and the others steal from, and the
+tasks from outside the pool go through a lock-free ring buffer. Run the program with "--benchmark [tasks [threads]]"
+to compare the throughput of empty tasks with that of the single locked queue this replaced, from 1 thread up.
+
+Tasks that depend on each other, like the stages of a pipeline, can be put in a TaskGraph, which runs each task once
+all the ones it depends on have finished, on the thread that finished the last of them if no other is idle.
+
+Every task has a priority class (interactive, normal or background) and optionally a deadline, and each class has
+queues of its own. The threads take the tasks of the most urgent class that has any, and within a class those with a
+deadline first, earliest first. A class that a thread has passed over for longer than its aging limit goes first,
+so that a steady stream of urgent tasks cannot starve the others. The time each task waited in the queues is counted
+in a latency histogram per class, and "--benchmark-priorities [threads]" compares the waits of interactive tasks
+among a backlog of background ones with and without the classes.
 
 Apart from the ThreadPool class, there is also a simple event loop to handle concurrent user input. This event
 loop runs on a separate thread and queries the event queue from time to time to process any valid input event.
@@ -26,20 +43,24 @@ It is responsible for signaling the task system to start, pause, resume or shutd
 In a real system, these operations can be replaced by anything else like a mouse click or an incoming network
 packet etc. Since this technically requires a thread to wait on multiple condition variables (one for the thread
 pool and potentially one for the task callback function, this gets a bit tricky. On Windows this is natively allowed
-but it becomes harder on Linux. Here we solve the problem by simulating a state machine using multiple shared boolean
-variables that affect the execution state of the callback functions.
+but it becomes harder on Linux. Here we solve the problem with a token per task (TaskToken), an atomic state
+machine that the pool, the user and the callback function share. The user (or the pool, on behalf of all its tasks)
+requests a pause or a cancellation through the token, and the callback function polls it at its checkpoints and
+returns early. A paused task is parked by the pool until it is resumed, so single tasks can be paused, resumed or
+cancelled while the others keep running.
 
 We have a couple of functions that represent a producer and a consumer, but these can be replaced with any compute
 heavy task. They share a resource variable (the shared buffer) that represents the execution state of the functions at 
 any point in time. Instead of waiting on condition variables, the worker threads wait on aquiring the lock on the 
 shared buffer in a spinlock. When execution is paused by the user and then later resumed, execution resumes from the
 point where it was interrupted. The atomic variable "resource", therefores also acts as a checkpoint for this resume
-operation. In a real system, such variables will be replaced by whatever state the application has that needs to be
-persisted across cycles of pause/resume operations. For e.g. a time point in a music player playing an MP3. This
-execution state could theorectically be serialized along with the queue of saved tasks so that the resume operation
-can be achieved even across different sessions of the application. This behavior is called re-entrant programming.
-The demo presented here should act as a starting design guide for implementing the ideas in a more complex real
-world application.
+operation, and every task saves its own progress (the units it has produced or consumed) in its token before it
+returns, to pick up from there when resumed. In a real system, such variables will be replaced by whatever state
+the application has that needs to be persisted across cycles of pause/resume operations. For e.g. a time point in a
+music player playing an MP3. This execution state could theorectically be serialized along with the queue of saved
+tasks so that the resume operation can be achieved even across different sessions of the application. This behavior
+is called re-entrant programming. The demo presented here should act as a starting design guide for implementing
+the ideas in a more complex real world application.
 
 To compile the code using GCC, use the flags "-pthread" and "-std=c++14", to link the POSIX threads library and 
 enable C++14 standard respectively.
@@ -57,6 +78,17 @@ enable C++14 standard respectively.
 #include <atomic>
 #include <random>
 #include <vector>
+#include <algorithm>
+#include <future>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
 
 // no. of threads to be used for producers and consumers
 const int nProd = 4;
@@ -66,10 +98,6 @@ std::atomic<int> resource(1); // simulates the shared buffer of produced resourc
 const int MAXSIZE = 10; // maximum value of the buffer
 std::mutex resourceMutex;
 
-bool shuttingDown = false;
-bool paused = false;
-bool resumed = false;
-
 // returns a random unit size in (0, MAXSIZE) to produce or consume
 size_t getRandUnitSize(std::default_random_engine &seed)
 {
@@ -78,11 +106,360 @@ size_t getRandUnitSize(std::default_random_engine &seed)
 	return static_cast<size_t>(trial * MAXSIZE);
 }
 
-// producer subroutine
-void produce(int id)
+// The priority classes of the tasks, most urgent first. The workers take the tasks of the most urgent class that has
+// any, so that a latency sensitive task does not wait behind bulk work, except that a class passed over for longer
+// than its aging limit goes first, so that the more urgent ones cannot starve it.
+enum struct Priority
+{
+	Interactive,
+	Normal,
+	Background
+};
+
+const size_t NUM_PRIORITIES = 3;
+const std::chrono::milliseconds AGING_LIMITS[NUM_PRIORITIES] =
+{
+	std::chrono::milliseconds(0), // never passed over
+	std::chrono::milliseconds(10),
+	std::chrono::milliseconds(100)
+};
+
+std::string getPriorityName(Priority priority)
+{
+	switch (priority)
+	{
+		case (Priority::Interactive):
+			return "interactive";
+			
+		case (Priority::Normal):
+			return "normal";
+			
+		case (Priority::Background):
+			return "background";
+			
+		default:
+			return "unknown";
+	}
+}
+
+typedef std::chrono::steady_clock Clock;
+const Clock::time_point NO_DEADLINE = Clock::time_point::max();
+
+class TaskToken;
+
+// Wrapper Task interface
+struct ITask
+{
+	enum struct TaskState
+	{
+		Uninitialized,
+		Waiting,
+		Running,
+		Paused,
+		Cancelled,
+		Finished
+	};
+	
+	std::string getState(TaskState state) const
+	{
+		switch (state)
+		{
+			case (TaskState::Uninitialized):
+				return "Uninitialized";
+				
+			case (TaskState::Waiting):
+				return "Waiting";
+				
+			case (TaskState::Running):
+				return "Running";
+				
+			case (TaskState::Paused):
+				return "Paused";
+				
+			case (TaskState::Cancelled):
+				return "Cancelled";
+				
+			case (TaskState::Finished):
+				return "Finished";
+				
+			default:
+				return "Unknown state";
+		}	
+	}
+	
+	virtual ~ITask() {}
+	
+	// Runs the task and returns whether it is done, rather than stopped early to be paused or cancelled. A task
+	// that is not done is run again once resumed.
+	virtual bool run() = 0;
+	
+	// Called by the pool instead of deleting the task once it is finished or dropped. Tasks that are owned elsewhere
+	// and run again, like the nodes of a task graph, do their bookkeeping here instead.
+	virtual void release() { delete this; }
+	
+	std::shared_ptr<TaskToken> token;
+	Priority priority = Priority::Normal;
+	Clock::time_point deadline = NO_DEADLINE; // the tasks of a class with a deadline go first, the earliest first
+	Clock::time_point enqueueTime; // when the task was last queued, for the latency histograms
+};
+
+// The control block of a single task, shared between the pool, the callback function and the user. Requests to
+// pause or cancel the task are only noted here, the callback function polls stopRequested() at its checkpoints and
+// returns when it is set, after saving its progress with saveCheckpoint() if it is to be resumed. Every member is
+// atomic, so the token can be used from any thread while the task runs. The state can also be waited on until the
+// task is finished or cancelled.
+class TaskToken
+{
+	
+public:
+	enum struct Request
+	{
+		None,
+		Pause,
+		Cancel
+	};
+	
+	TaskToken() :
+		request(Request::None),
+		state(ITask::TaskState::Uninitialized),
+		checkpoint(0),
+		numRuns(0)
+	{
+	}
+	
+	// a cancellation is final, so it is never turned into a pause
+	void requestPause()
+	{
+		Request expected = Request::None;
+		request.compare_exchange_strong(expected, Request::Pause);
+	}
+	
+	void requestResume()
+	{
+		Request expected = Request::Pause;
+		request.compare_exchange_strong(expected, Request::None);
+	}
+	
+	void requestCancel()
+	{
+		request = Request::Cancel;
+	}
+	
+	bool stopRequested() const { return request != Request::None; }
+	bool isPauseRequested() const { return request == Request::Pause; }
+	bool isCancelRequested() const { return request == Request::Cancel; }
+	
+	// true from the second run of the task on, that is once it has been paused and resumed
+	bool isResumed() const { return numRuns > 1; }
+	
+	void saveCheckpoint(uint64_t value) { checkpoint = value; }
+	uint64_t getCheckpoint() const { return checkpoint; }
+	
+	ITask::TaskState getState() const { return state; }
+	void countRun() { ++numRuns; }
+	
+	// forgets the request, progress and state of a task that is done, so that it can be run again
+	void reset()
+	{
+		request = Request::None;
+		checkpoint = 0;
+		numRuns = 0;
+		setState(ITask::TaskState::Waiting);
+	}
+	
+	void setState(ITask::TaskState state_)
+	{
+		std::unique_lock<std::mutex> lock(stateMutex);
+		state = state_;
+		if (isDone())
+			doneCV.notify_all();
+	}
+	
+	bool isDone() const
+	{
+		return state == ITask::TaskState::Finished || state == ITask::TaskState::Cancelled;
+	}
+	
+	// blocks until the task is finished or cancelled
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(stateMutex);
+		doneCV.wait(lock, [this]() { return isDone(); });
+	}
+	
+	// returns false if the task is still not done after the timeout
+	template <typename Rep, typename Period>
+	bool waitFor(const std::chrono::duration<Rep, Period> &timeout)
+	{
+		std::unique_lock<std::mutex> lock(stateMutex);
+		return doneCV.wait_for(lock, timeout, [this]() { return isDone(); });
+	}
+	
+private:
+	std::atomic<Request> request;
+	std::atomic<ITask::TaskState> state;
+	std::atomic<uint64_t> checkpoint; // progress of the callback function, kept across pauses
+	std::atomic<int> numRuns;
+	
+	std::mutex stateMutex;
+	std::condition_variable doneCV;
+};
+
+// The token of a task submitted with ThreadPool::submit(), which also holds its result or the exception it threw,
+// so that the result takes no allocation of its own. The result is written before the task is marked finished,
+// and read only after, so the state mutex orders the two.
+template
+<typename R>
+class FutureState : public TaskToken
+{
+	
+public:
+	FutureState() : hasValue(false) {}
+	
+	~FutureState()
+	{
+		if (hasValue)
+			reinterpret_cast<R *>(&storage)->~R();
+	}
+	
+	template <typename F>
+	void invoke(F &&f)
+	{
+		try
+		{
+			new (&storage) R(f());
+			hasValue = true;
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+	}
+	
+	// moves the result out, so it can only be taken once
+	R get()
+	{
+		wait();
+		if (exception)
+			std::rethrow_exception(exception);
+		if (!hasValue)
+			throw std::future_error(std::future_errc::broken_promise); // cancelled before it ran
+		
+		return std::move(*reinterpret_cast<R *>(&storage));
+	}
+	
+private:
+	typename std::aligned_storage<sizeof(R), alignof(R)>::type storage;
+	bool hasValue;
+	std::exception_ptr exception;
+};
+
+// the result of a task that returns a reference is kept as a pointer to what it refers to
+template
+<typename R>
+class FutureState<R &> : public TaskToken
+{
+	
+public:
+	FutureState() : value(nullptr) {}
+	
+	template <typename F>
+	void invoke(F &&f)
+	{
+		try
+		{
+			value = std::addressof(f());
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+	}
+	
+	R &get()
+	{
+		wait();
+		if (exception)
+			std::rethrow_exception(exception);
+		if (!value)
+			throw std::future_error(std::future_errc::broken_promise); // cancelled before it ran
+		
+		return *value;
+	}
+	
+private:
+	R *value;
+	std::exception_ptr exception;
+};
+
+template
+<>
+class FutureState<void> : public TaskToken
+{
+	
+public:
+	template <typename F>
+	void invoke(F &&f)
+	{
+		try
+		{
+			f();
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+	}
+	
+	void get()
+	{
+		wait();
+		if (exception)
+			std::rethrow_exception(exception);
+		if (getState() != ITask::TaskState::Finished)
+			throw std::future_error(std::future_errc::broken_promise); // cancelled before it ran
+	}
+	
+private:
+	std::exception_ptr exception;
+};
+
+// Handle to the result of a submitted task, used like std::future. It shares its state with the task token, which
+// also lets the task be paused or cancelled through the pool as long as it has not started.
+template
+<typename R>
+class Future
+{
+	
+public:
+	Future() {}
+	explicit Future(std::shared_ptr<FutureState<R>> state_) : state(std::move(state_)) {}
+	
+	bool valid() const { return state != nullptr; }
+	void wait() const { state->wait(); }
+	
+	template <typename Rep, typename Period>
+	bool waitFor(const std::chrono::duration<Rep, Period> &timeout) const { return state->waitFor(timeout); }
+	
+	// waits for the result and returns it, rethrowing what the task threw, after which the future is no longer valid
+	R get()
+	{
+		std::shared_ptr<FutureState<R>> result = std::move(state);
+		return result->get();
+	}
+	
+	std::shared_ptr<TaskToken> getToken() const { return state; }
+	
+private:
+	std::shared_ptr<FutureState<R>> state;
+};
+
+// producer subroutine, the checkpoint is the number of units produced so far
+void produce(int id, TaskToken &token)
 {
-	if (resumed) // there's a bug here. This should be done for each task using it's own TaskState
-		std::cout << "Resuming producer...\n";
+	uint64_t numProduced = token.getCheckpoint();
+	if (token.isResumed())
+		std::cout << "Resuming producer " << id << " after " << numProduced << " units...\n";
 		
 	size_t tid = std::hash<std::thread::id>()(std::this_thread::get_id());
 	
@@ -92,7 +469,7 @@ void produce(int id)
 									(std::chrono::system_clock::to_time_t
 									((std::chrono::system_clock::now()))));
 		
-	while (!shuttingDown && !paused)
+	while (!token.stopRequested())
 	{
 		std::unique_lock<std::mutex> lock(resourceMutex);
 		std::cout << "Lock acquired by producer " << id << " ... " << std::endl;
@@ -114,20 +491,23 @@ void produce(int id)
 		}
 		
 		resource += units;
+		numProduced += units;
 		std::cout << "Produced " << units << " units." << std::endl;
 		std::cout << "Total: " << resource << "\n\n" << std::endl;
 		lock.unlock();		
 	}
 	
-	if (paused) // there's a bug here. This should be done for each task using it's own TaskState
-		std::cout << "Pausing producer...\n";
+	token.saveCheckpoint(numProduced);
+	if (token.isPauseRequested())
+		std::cout << "Pausing producer " << id << "...\n";
 }
 
-// consumer subroutine
-void consume(int id)
+// consumer subroutine, the checkpoint is the number of units consumed so far
+void consume(int id, TaskToken &token)
 {
-	if (resumed) // there's a bug here. This should be done for each task using its own TaskState
-		std::cout << "Resuming consumer...\n";
+	uint64_t numConsumed = token.getCheckpoint();
+	if (token.isResumed())
+		std::cout << "Resuming consumer " << id << " after " << numConsumed << " units...\n";
 		
 	size_t tid = std::hash<std::thread::id>()(std::this_thread::get_id());
 	
@@ -137,7 +517,7 @@ void consume(int id)
 									(std::chrono::system_clock::to_time_t
 									((std::chrono::system_clock::now()))));
 		
-	while (!shuttingDown && !paused)
+	while (!token.stopRequested())
 	{
 		std::unique_lock<std::mutex> lock(resourceMutex);
 		std::cout << "Lock acquired by consumer " << id << " ... " << std::endl;
@@ -159,164 +539,1408 @@ void consume(int id)
 		}
 
 		resource -= units;
+		numConsumed += units;
 		std::cout << "Consumed " << units << " units." << std::endl;
 		std::cout << "Total: " << resource << "\n\n" << std::endl;
 		lock.unlock();		
 	}
 	
-	if (paused) // there's a bug here. This should be done for each task using its own TaskState
-		std::cout << "Pausing consumer...\n";
+	token.saveCheckpoint(numConsumed);
+	if (token.isPauseRequested())
+		std::cout << "Pausing consumer " << id << "...\n";
 }
 
-// Wrapper Task interface
-struct ITask
-{
-	enum struct TaskState
-	{
-		Uninitialized,
-		Waiting,
-		Running,
-		Paused,
-		Finished
-	};
-	
-	std::string getState(TaskState state) const
-	{
-		switch (state)
-		{
-			case (TaskState::Uninitialized):
-				return "Uninitialized";
-				
-			case (TaskState::Waiting):
-				return "Waiting";
-				
-			case (TaskState::Running):
-				return "Running";
-				
-			case (TaskState::Paused):
-				return "Paused";
-				
-			case (TaskState::Finished):
-				return "Finished";
-				
-			default:
-				return "Unknown state";
-		}	
-	}		
-};
-
 // Wrapper for the callback function that represents the task to be executed
 template
 <typename T>
 struct Task : public ITask
 {
-	TaskState state;
-	std::function<T()> job;
+	std::function<T(TaskToken &)> job;
 	
-	Task(std::function<T()> &job_) :
-		state(TaskState::Uninitialized),
+	Task(std::function<T(TaskToken &)> &job_) :
 		job(std::move(job_))
 	{
+		token = std::make_shared<TaskToken>();
+		token->setState(TaskState::Waiting);
 	}
 	
-	T run()
+	// the callback function returns early when asked to stop, without finishing
+	bool run() override
 	{
-		state = TaskState::Running;
 		std::cout << "Running..." << std::endl;
-		return job();
+		job(*token);
+		return !token->stopRequested();
 	}
 };
 
-class ThreadPool
+// The INVOKE of the standard, which std::invoke only offers from C++17 on: calls f(args...), or applies a pointer to a
+// member function or data member to the object given first, or to the object it points to.
+template <typename C, typename T>
+using IsObjectOf = std::is_base_of<C, typename std::decay<T>::type>;
+
+template <typename C, typename T, typename std::enable_if<IsObjectOf<C, T>::value, int>::type = 0>
+T &&getMemberObject(T &&object)
+{
+	return std::forward<T>(object);
+}
+
+template <typename C, typename T, typename std::enable_if<!IsObjectOf<C, T>::value, int>::type = 0>
+auto getMemberObject(T &&pointer) -> decltype(*std::forward<T>(pointer))
+{
+	return *std::forward<T>(pointer);
+}
+
+template <typename F, typename... Args>
+auto invokeCallable(F &&f, Args &&... args) -> decltype(std::forward<F>(f)(std::forward<Args>(args)...))
+{
+	return std::forward<F>(f)(std::forward<Args>(args)...);
+}
+
+template <typename M, typename C, typename T, typename... Args,
+		  typename std::enable_if<std::is_function<M>::value, int>::type = 0>
+auto invokeCallable(M C::*f, T &&object, Args &&... args)
+	-> decltype((getMemberObject<C>(std::forward<T>(object)).*f)(std::forward<Args>(args)...))
+{
+	return (getMemberObject<C>(std::forward<T>(object)).*f)(std::forward<Args>(args)...);
+}
+
+template <typename M, typename C, typename T, typename std::enable_if<!std::is_function<M>::value, int>::type = 0>
+auto invokeCallable(M C::*f, T &&object) -> decltype(getMemberObject<C>(std::forward<T>(object)).*f)
+{
+	return getMemberObject<C>(std::forward<T>(object)).*f;
+}
+
+// the result of running the decayed copies of f and args that a task keeps, which it passes on as rvalues
+template <typename F, typename... Args>
+using SubmitResult = decltype(invokeCallable(std::declval<typename std::decay<F>::type>(),
+											 std::declval<typename std::decay<Args>::type>()...));
+
+// A callable with its arguments, stored in the task itself instead of behind a std::function, and run once. It
+// does not poll its token, so a pause or a cancellation only takes effect if it comes before the task starts. As it
+// runs only once, the callable and the arguments are moved into the call, so that move-only ones can be passed.
+template
+<typename R, typename F, typename... Args>
+struct CallableTask : public ITask
 {
+	F f;
+	std::tuple<Args...> args;
+	std::shared_ptr<FutureState<R>> state;
 	
-public:
-	ThreadPool() : 
-		poolSize(std::thread::hardware_concurrency() + 2),
-		nThreads(std::thread::hardware_concurrency()),
-		numFinishedThreads(0),
-		isStarted(false),
-		isPaused(false),
-		isShuttingDown(false)
+	template <typename G, typename... A>
+	CallableTask(std::shared_ptr<FutureState<R>> state_, G &&f_, A &&... args_) :
+		f(std::forward<G>(f_)),
+		args(std::forward<A>(args_)...),
+		state(std::move(state_))
 	{
+		token = state;
+		token->setState(TaskState::Waiting);
 	}
 	
-	~ThreadPool()
+	bool run() override
 	{
-		while (!isShuttingDown);
-		
-		waitCV.notify_all();
-		for (size_t i = 0; i < pool.size(); ++i)
-			pool[i].join();
+		invoke(std::index_sequence_for<Args...>());
+		return true;
 	}
 	
-	// creates threads and puts them in waiting state
-	void init()
+	template <size_t... I>
+	void invoke(std::index_sequence<I...>)
 	{
-		for (size_t i = 0; i < poolSize; ++i)
-		{
-			std::thread worker([&, this]() { wait(); });
-			pool.push_back(std::move(worker));
-		}
+		state->invoke([this]() -> R { return invokeCallable(std::move(f), std::move(std::get<I>(args))...); });
+	}
+};
+
+const std::chrono::milliseconds NO_TIMEOUT = std::chrono::milliseconds::max();
+const size_t CACHE_LINE_SIZE = 64;
+
+// Base of the classes with members aligned to cache lines of their own, whose heap allocations have to be aligned as
+// well, which the global operator new only does from C++17 on.
+struct CacheAligned
+{
+	static void *operator new(size_t size)
+	{
+		void *memory = nullptr;
+		if (posix_memalign(&memory, CACHE_LINE_SIZE, size) != 0)
+			throw std::bad_alloc();
+		return memory;
 	}
 	
-	// starts the execution of tasks present in the task queue
-	void start()
+	static void operator delete(void *memory)
 	{
-		if (isStarted)
-		{
+		std::free(memory);
+	}
+};
+
+// Chase-Lev deque of tasks, in the C11 formulation of Le, Pop, Cohen and Zappa Nardelli (PPoPP 2013). The worker that
+// owns it pushes and pops at the bottom, last in first out, so that the tasks it spawns run while their data is still
+// in its cache. Other workers steal from the top, first in first out, which takes the oldest and usually largest
+// tasks. Neither end takes a lock, the owner and the thieves only race for the last task, with a CAS on top. The
+// orderings that the paper gets from fences come from sequentially consistent operations on top and bottom here,
+// which cost the same on x86 and which ThreadSanitizer can check, as it does not model standalone fences. The
+// array grows when full, and the old ones are kept until the deque is destroyed, since a thief may still read them.
+class WorkStealingDeque
+{
+	
+public:
+	explicit WorkStealingDeque(size_t capacity = 256) :
+		top(0),
+		bottom(0),
+		array(new Array(capacity))
+	{
+	}
+	
+	~WorkStealingDeque()
+	{
+		delete array.load();
+	}
+	
+	// owner only
+	void push(ITask *task)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		Array *a = array.load(std::memory_order_relaxed);
+		if (b - t > static_cast<int64_t>(a->mask))
+			a = grow(a, t, b);
+		
+		a->put(b, task);
+		bottom.store(b + 1, std::memory_order_release);
+	}
+	
+	// owner only, returns nullptr if empty
+	ITask *pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		Array *a = array.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_seq_cst);
+		
+		if (t > b) // empty
+		{
+			bottom.store(b + 1, std::memory_order_release);
+			return nullptr;
+		}
+		
+		ITask *task = a->get(b);
+		if (t == b) // the last one, which a thief may be taking as well
+		{
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				task = nullptr;
+			bottom.store(b + 1, std::memory_order_release);
+		}
+		return task;
+	}
+	
+	// any thread, returns nullptr if empty or if another thread took the task first
+	ITask *steal()
+	{
+		int64_t t = top.load(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_seq_cst);
+		if (t >= b)
+			return nullptr;
+		
+		ITask *task = array.load(std::memory_order_acquire)->get(t);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return task;
+	}
+	
+	// only a hint while the owner or the thieves are at work
+	bool empty() const
+	{
+		return bottom.load() <= top.load();
+	}
+	
+private:
+	struct Array
+	{
+		explicit Array(size_t capacity) : mask(capacity - 1), tasks(new std::atomic<ITask *>[capacity]) {}
+		
+		ITask *get(int64_t i) const { return tasks[i & mask].load(std::memory_order_relaxed); }
+		void put(int64_t i, ITask *task) { tasks[i & mask].store(task, std::memory_order_relaxed); }
+		
+		const size_t mask; // capacity - 1, the capacity being a power of 2
+		std::unique_ptr<std::atomic<ITask *>[]> tasks;
+	};
+	
+	Array *grow(Array *a, int64_t t, int64_t b)
+	{
+		Array *grown = new Array(2 * (a->mask + 1));
+		for (int64_t i = t; i < b; ++i)
+			grown->put(i, a->get(i));
+		
+		retired.emplace_back(a);
+		array.store(grown, std::memory_order_release);
+		return grown;
+	}
+	
+	// top and bottom on cache lines of their own, as the thieves write the one and the owner the other
+	alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top;
+	alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom;
+	std::atomic<Array *> array;
+	std::vector<std::unique_ptr<Array>> retired; // owner only
+};
+
+// The queue of the tasks added from outside the pool, which any worker takes from. It is Vyukov's bounded MPMC queue,
+// a ring of cells that producers and consumers claim with a CAS on their own position each, and whose sequence
+// number tells whether the cell is free or full. The ring is large enough for the usual bursts, and a task that does
+// not fit goes to an overflow queue behind a mutex, which is only looked at while it is not empty.
+class InjectionQueue
+{
+	
+public:
+	explicit InjectionQueue(size_t capacity = 1 << 14) :
+		mask(capacity - 1),
+		cells(new Cell[capacity]),
+		enqueuePos(0),
+		dequeuePos(0),
+		numOverflowed(0)
+	{
+		for (size_t i = 0; i < capacity; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	
+	void push(ITask *task)
+	{
+		if (numOverflowed.load(std::memory_order_relaxed) == 0 && tryPush(task))
+			return;
+		
+		std::unique_lock<std::mutex> lock(overflowMutex);
+		overflow.push(task);
+		++numOverflowed;
+	}
+	
+	// returns nullptr if empty
+	ITask *pop()
+	{
+		ITask *task = tryPop();
+		if (task || numOverflowed.load() == 0)
+			return task;
+		
+		std::unique_lock<std::mutex> lock(overflowMutex);
+		if (overflow.empty())
+			return nullptr;
+		
+		task = overflow.front();
+		overflow.pop();
+		--numOverflowed;
+		return task;
+	}
+	
+	// only a hint while tasks are pushed or popped
+	bool empty() const
+	{
+		return enqueuePos.load() == dequeuePos.load() && numOverflowed.load() == 0;
+	}
+	
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence; // position of the cell when free, position + 1 when it holds a task
+		ITask *task;
+	};
+	
+	bool tryPush(ITask *task)
+	{
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		Cell *cell;
+		while (true)
+		{
+			cell = &cells[pos & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+			if (diff == 0)
+			{
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) // full
+				return false;
+			else // another producer claimed the cell
+				pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+		
+		cell->task = task;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+	
+	ITask *tryPop()
+	{
+		size_t pos = dequeuePos.load(std::memory_order_relaxed);
+		Cell *cell;
+		while (true)
+		{
+			cell = &cells[pos & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0)
+			{
+				if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) // empty
+				return nullptr;
+			else // another consumer claimed the cell
+				pos = dequeuePos.load(std::memory_order_relaxed);
+		}
+		
+		ITask *task = cell->task;
+		cell->sequence.store(pos + mask + 1, std::memory_order_release);
+		return task;
+	}
+	
+	const size_t mask;
+	std::unique_ptr<Cell[]> cells;
+	
+	// on cache lines of their own, as the producers write the one and the consumers the other
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueuePos;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeuePos;
+	
+	alignas(CACHE_LINE_SIZE) std::mutex overflowMutex;
+	std::queue<ITask *> overflow;
+	std::atomic<size_t> numOverflowed;
+};
+
+// The time the tasks of one priority class waited in the queues before they started, counted in buckets of powers of
+// 2 microseconds: bucket 0 counts the waits under 1 us, and bucket i > 0 the waits from 2^(i - 1) up to 2^i us.
+struct LatencyHistogram
+{
+	static const size_t NUM_BUCKETS = 32;
+	
+	LatencyHistogram() : numMissedDeadlines(0)
+	{
+		std::fill(buckets, buckets + NUM_BUCKETS, 0);
+	}
+	
+	static size_t getBucket(uint64_t microseconds)
+	{
+		size_t bucket = 0;
+		for (; microseconds > 0 && bucket < NUM_BUCKETS - 1; microseconds >>= 1)
+			++bucket;
+		return bucket;
+	}
+	
+	uint64_t getCount() const
+	{
+		uint64_t count = 0;
+		for (size_t i = 0; i < NUM_BUCKETS; ++i)
+			count += buckets[i];
+		return count;
+	}
+	
+	// the upper bound in microseconds of the bucket that the given fraction of the waits falls in, 0 if none
+	uint64_t getPercentile(double fraction) const
+	{
+		const uint64_t count = getCount();
+		if (count == 0)
+			return 0;
+		
+		const uint64_t rank = std::max(static_cast<uint64_t>(std::ceil(fraction * count)), uint64_t(1));
+		uint64_t numSeen = 0;
+		for (size_t i = 0; i < NUM_BUCKETS; ++i)
+		{
+			numSeen += buckets[i];
+			if (numSeen >= rank)
+				return uint64_t(1) << i;
+		}
+		return uint64_t(1) << (NUM_BUCKETS - 1);
+	}
+	
+	uint64_t buckets[NUM_BUCKETS];
+	uint64_t numMissedDeadlines; // tasks that started after their deadline
+};
+
+class ThreadPool : public CacheAligned
+{
+	
+public:
+	enum struct ShutdownMode
+	{
+		Drain, // run the queued and parked tasks to completion first
+		Cancel // drop the queued and parked tasks, and stop the running ones at their next checkpoint
+	};
+	
+	// what became of the tasks that were queued, parked or running when the pool was shut down
+	struct ShutdownReport
+	{
+		size_t numDrained = 0; // ran to completion
+		size_t numDropped = 0; // cancelled, whether they had started or not
+		bool isTimedOut = false; // the drain ran out of time and the remaining tasks were cancelled
+	};
+	
+	// A pool that is not prioritized queues every task as normal, without deadline, as a baseline for the latency
+	// histograms, which still count the waits by the class of the tasks.
+	explicit ThreadPool(size_t poolSize_ = std::thread::hardware_concurrency() + 2, bool isPrioritized_ = true) : 
+		poolSize(poolSize_),
+		nThreads(std::thread::hardware_concurrency()),
+		isPrioritized(isPrioritized_),
+		numPending(0),
+		numSleeping(0),
+		numFinishedTasks(0),
+		numDroppedTasks(0),
+		isStarted(false),
+		isPaused(false),
+		isAccepting(true),
+		isCancelling(false),
+		isShuttingDown(false)
+	{
+		for (size_t i = 0; i < poolSize; ++i)
+			workers.emplace_back(new Worker(i));
+	}
+	
+	~ThreadPool()
+	{
+		if (!isShuttingDown)
+			shutdown(ShutdownMode::Cancel);
+	}
+	
+	// creates threads and puts them in waiting state
+	void init()
+	{
+		for (size_t i = 0; i < poolSize; ++i)
+		{
+			std::thread worker([this, i]() { wait(i); });
+			pool.push_back(std::move(worker));
+		}
+	}
+	
+	// starts the execution of tasks present in the task queue
+	void start()
+	{
+		if (isStarted)
+		{
 			std::cout << "Task execution has already started. Skipping operation...\n";
 			return;
 		}
 		
-		isStarted = true;
-		isPaused = false;
-		std::cout << "Execution started...\n";
-		waitCV.notify_all();
-	}		
+		isStarted = true;
+		isPaused = false;
+		std::cout << "Execution started...\n";
+		notifyWorkers();
+	}		
+	
+	// pauses all execution of tasks by putting the threads in the waiting state, the running tasks
+	// stop at their next checkpoint and are parked until resumed
+	void pause()
+	{
+		if (!isStarted)
+		{
+			std::cout << "Task execution has not been started yet. Invalid operation!\n";
+			return;
+		}
+		
+		std::unique_lock<std::mutex> lock(queueMutex);
+		if (!isAccepting) // a drain runs every task to completion, a paused pool would never get there
+			return;
+		
+		isPaused = true;
+		requestAll(&TaskToken::requestPause);
+	}
+	
+	// resumes execution of tasks, including the ones that were paused one by one
+	void resume()
+	{
+		if (!isStarted)
+		{
+			std::cout << "Task execution has not been started yet. Invalid operation!\n";
+			return;
+		}
+		
+		if (isPaused)
+		{
+			std::vector<ITask *> dropped;
+			std::unique_lock<std::mutex> lock(queueMutex);
+			isPaused = false;
+			requestAll(&TaskToken::requestResume);
+			requeuePausedTasks(dropped);
+			lock.unlock();
+			
+			releaseTasks(dropped);
+			notifyWorkers();
+		}
+	}
+	
+	// asks a single task to stop at its next checkpoint, or not to start at all if it is still queued; ignored once
+	// the pool is shutting down, as a parked task would hold up the drain for good
+	void pauseTask(const std::shared_ptr<TaskToken> &token)
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		if (isAccepting)
+			token->requestPause();
+	}
+	
+	void resumeTask(const std::shared_ptr<TaskToken> &token)
+	{
+		std::vector<ITask *> dropped;
+		std::unique_lock<std::mutex> lock(queueMutex);
+		token->requestResume();
+		requeuePausedTasks(dropped);
+		lock.unlock();
+		
+		releaseTasks(dropped);
+		notifyWorkers();
+	}
+	
+	// a running task stops at its next checkpoint, a queued or parked one never runs again
+	void cancelTask(const std::shared_ptr<TaskToken> &token)
+	{
+		std::vector<ITask *> dropped;
+		std::unique_lock<std::mutex> lock(queueMutex);
+		token->requestCancel();
+		requeuePausedTasks(dropped);
+		lock.unlock();
+		
+		releaseTasks(dropped);
+	}
+	
+	// Stops accepting tasks, drains or cancels the ones left, and joins the threads once none is running any more.
+	// A drain that has not finished within the timeout cancels the remaining tasks. Blocks until done.
+	ShutdownReport shutdown(ShutdownMode mode = ShutdownMode::Cancel, std::chrono::milliseconds timeout = NO_TIMEOUT)
+	{
+		ShutdownReport report;
+		std::vector<ITask *> dropped;
+		std::unique_lock<std::mutex> lock(queueMutex);
+		if (!isAccepting)
+			return report;
+		
+		isAccepting = false;
+		const size_t numFinishedBefore = numFinishedTasks, numDroppedBefore = numDroppedTasks;
+		
+		if (mode == ShutdownMode::Drain)
+		{
+			// parked tasks are queued work too, and the queue may not even have been started
+			requestAll(&TaskToken::requestResume);
+			requeuePausedTasks(dropped);
+			isPaused = false;
+			isStarted = true;
+			lock.unlock();
+			notifyWorkers();
+			lock.lock();
+			
+			auto isIdle = [this]() { return numPending == 0 && pausedTasks.empty(); };
+			if (timeout == NO_TIMEOUT)
+				idleCV.wait(lock, isIdle);
+			else
+				report.isTimedOut = !idleCV.wait_for(lock, timeout, isIdle);
+		}
+		
+		// from here on the workers drop whatever they take off the queues
+		isCancelling = true;
+		requestAll(&TaskToken::requestCancel);
+		requeuePausedTasks(dropped);
+		lock.unlock();
+		releaseTasks(dropped);
+		notifyWorkers();
+		
+		// the queues are emptied here as well, in case the threads were never created
+		while (ITask *task = findTask(poolSize))
+			dropTask(task);
+		
+		lock.lock();
+		idleCV.wait(lock, [this]() { return numPending == 0; });
+		
+		report.numDrained = numFinishedTasks - numFinishedBefore;
+		report.numDropped = numDroppedTasks - numDroppedBefore;
+		isShuttingDown = true;
+		lock.unlock();
+		
+		notifyWorkers();
+		for (size_t i = 0; i < pool.size(); ++i)
+			pool[i].join();
+		pool.clear();
+		
+		return report;
+	}	
+	
+	// blocks until every task added so far, and every task they added in turn, is finished, dropped or parked
+	void waitIdle()
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		idleCV.wait(lock, [this]() { return numPending == 0; });
+	}
+	
+	// checks if there are new or partially finished (saved) tasks in any queue, which is only a hint while the
+	// workers are running
+	bool tasksAvailable() const
+	{
+		for (size_t i = 0; i < NUM_PRIORITIES; ++i)
+			if (classQueues[i].numQueued > 0)
+				return true;
+		return false;
+	}
+	
+	// the waits of the tasks of a class that have started so far, over all the workers
+	LatencyHistogram getLatencyHistogram(Priority priority) const
+	{
+		const size_t c = static_cast<size_t>(priority);
+		LatencyHistogram histogram;
+		for (auto &worker : workers)
+		{
+			for (size_t i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i)
+				histogram.buckets[i] += worker->waitBuckets[c][i].load(std::memory_order_relaxed);
+			histogram.numMissedDeadlines += worker->numMissedDeadlines[c].load(std::memory_order_relaxed);
+		}
+		return histogram;
+	}
+	
+	// Queues f(args...) and returns the future of its result, like std::async. The callable and copies of the
+	// arguments are kept in the task, and the result in the task token, so that a task takes two allocations and no
+	// std::function.
+	template <typename F, typename... Args>
+	Future<SubmitResult<F, Args...>> submit(F &&f, Args &&... args)
+	{
+		return submit(Priority::Normal, NO_DEADLINE, std::forward<F>(f), std::forward<Args>(args)...);
+	}
+	
+	// the same with the given priority, and a deadline unless NO_DEADLINE
+	template <typename F, typename... Args>
+	Future<SubmitResult<F, Args...>> submit(Priority priority, Clock::time_point deadline, F &&f, Args &&... args)
+	{
+		typedef SubmitResult<F, Args...> R;
+		static_assert(!std::is_rvalue_reference<R>::value, "a task cannot return an rvalue reference");
+		typedef CallableTask<R, typename std::decay<F>::type, typename std::decay<Args>::type...> TaskType;
+		
+		std::shared_ptr<FutureState<R>> state = std::make_shared<FutureState<R>>();
+		addTask(std::unique_ptr<ITask>(new TaskType(state, std::forward<F>(f), std::forward<Args>(args)...)), priority, deadline);
+		return Future<R>(std::move(state));
+	}
+	
+	// Returns the token through which the task can be paused, resumed or cancelled on its own. A task added by a
+	// task running in this pool goes to the deque of the worker running it, any other to the injection queue, unless
+	// it has a deadline.
+	std::shared_ptr<TaskToken> addTask(std::unique_ptr<ITask> &&task)
+	{
+		return addTask(task.release());
+	}
+	
+	std::shared_ptr<TaskToken> addTask(std::unique_ptr<ITask> &&task, Priority priority, Clock::time_point deadline = NO_DEADLINE)
+	{
+		task->priority = priority;
+		task->deadline = deadline;
+		return addTask(task.release());
+	}
+	
+	// for tasks that the pool does not own, which take care of themselves in release()
+	std::shared_ptr<TaskToken> addTask(ITask *task)
+	{
+		std::shared_ptr<TaskToken> token = task->token;
+		
+		// Counted before checking, so that shutdown() waits for the task if it gets past the check. The tasks added
+		// by the tasks being drained are part of the drain.
+		const WorkerContext &context = getWorkerContext();
+		++numPending;
+		if (!isAccepting && (context.pool != this || isCancelling))
+		{
+			std::cout << "The thread pool is shutting down. Dropping task...\n";
+			token->requestCancel();
+			token->setState(ITask::TaskState::Cancelled);
+			task->release();
+			releasePending();
+			return token;
+		}
+		
+		pushTask(task, (context.pool == this) ? workers[context.index].get() : nullptr);
+		notifyWorker();
+		return token;
+	}	
+	
+private:
+	struct Worker : public CacheAligned
+	{
+		explicit Worker(size_t index) : current(nullptr), rng(static_cast<unsigned>(index + 1))
+		{
+			for (size_t c = 0; c < NUM_PRIORITIES; ++c)
+			{
+				passedOverSince[c] = Clock::time_point::max();
+				for (size_t i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i)
+					waitBuckets[c][i].store(0, std::memory_order_relaxed);
+				numMissedDeadlines[c].store(0, std::memory_order_relaxed);
+			}
+		}
+		
+		WorkStealingDeque deques[NUM_PRIORITIES];
+		std::mutex currentMutex;
+		TaskToken *current; // of the task being run, guarded by the current mutex
+		std::minstd_rand rng; // picks the first worker to steal from
+		
+		// since when this worker has been taking the tasks of other classes while there were tasks of this one
+		Clock::time_point passedOverSince[NUM_PRIORITIES];
+		
+		// written by this worker only, so without atomic read-modify-write, and summed up by getLatencyHistogram()
+		std::atomic<uint64_t> waitBuckets[NUM_PRIORITIES][LatencyHistogram::NUM_BUCKETS];
+		std::atomic<uint64_t> numMissedDeadlines[NUM_PRIORITIES];
+	};
+	
+	// the queues of one priority class that all the workers share
+	struct ClassQueues
+	{
+		ClassQueues() : numDeadlines(0), numQueued(0) {}
+		
+		InjectionQueue injectionQueue;
+		std::mutex deadlineMutex;
+		std::vector<ITask *> deadlineHeap; // earliest deadline first, guarded by the deadline mutex
+		std::atomic<size_t> numDeadlines; // the size of the heap, to skip the mutex while it is empty
+		alignas(CACHE_LINE_SIZE) std::atomic<int64_t> numQueued; // in any queue of the class, which may be off by a few while tasks are pushed or popped
+	};
+	
+	// the pool and index of the worker that the calling thread is, if any
+	struct WorkerContext
+	{
+		ThreadPool *pool;
+		size_t index;
+	};
+	
+	static WorkerContext &getWorkerContext()
+	{
+		static thread_local WorkerContext context = {nullptr, 0};
+		return context;
+	}
+	
+	// takes the mutex of the waiting state first, so that no thread misses the notification between checking
+	// its wake up conditions and going to sleep
+	void notifyWorkers()
+	{
+		std::unique_lock<std::mutex> lock(waitMutex);
+		waitCV.notify_all();
+	}
+	
+	// Wakes a single thread for a single new task, if any is asleep. The task was counted in its class with a
+	// sequentially consistent increment, and a worker going to sleep counts itself the same way before it reads the
+	// counts of the classes, so either the worker sees the new task or the worker is seen here.
+	void notifyWorker()
+	{
+		if (numSleeping == 0)
+			return;
+		
+		std::unique_lock<std::mutex> lock(waitMutex);
+		waitCV.notify_one();
+	}
+	
+	// makes the request of all the running and parked tasks, with the queue mutex held
+	void requestAll(void (TaskToken::*request)())
+	{
+		for (auto &worker : workers)
+		{
+			std::unique_lock<std::mutex> lock(worker->currentMutex);
+			if (worker->current)
+				(worker->current->*request)();
+		}
+		
+		for (ITask *task : pausedTasks)
+			(task->token.get()->*request)();
+	}
+	
+	// Queues a task in its class, in the heap of the tasks with a deadline if it has one, otherwise in the deque of the
+	// worker adding it, if any, or else in the injection queue. The task is counted once it is in, so that a worker
+	// may not take the count for a task it cannot find yet, and the count is what notifyWorker() is fenced against.
+	void pushTask(ITask *task, Worker *worker)
+	{
+		const size_t c = isPrioritized ? static_cast<size_t>(task->priority) : static_cast<size_t>(Priority::Normal);
+		ClassQueues &queues = classQueues[c];
+		task->enqueueTime = Clock::now();
+		
+		if (isPrioritized && task->deadline != NO_DEADLINE)
+		{
+			std::unique_lock<std::mutex> lock(queues.deadlineMutex);
+			queues.deadlineHeap.push_back(task);
+			std::push_heap(queues.deadlineHeap.begin(), queues.deadlineHeap.end(), isLaterDeadline);
+			++queues.numDeadlines;
+		}
+		else if (worker)
+			worker->deques[c].push(task);
+		else
+			queues.injectionQueue.push(task);
+		
+		++queues.numQueued;
+	}
+	
+	static bool isLaterDeadline(const ITask *a, const ITask *b)
+	{
+		return a->deadline > b->deadline;
+	}
+	
+	// Takes the most urgent task there is, from the first class that has any in order of priority, unless a class
+	// with tasks has been passed over by this worker for longer than its aging limit, which then goes first. Without
+	// a worker, as during shutdown(), the classes are simply taken in order.
+	ITask *findTask(size_t index)
+	{
+		if (index >= poolSize)
+		{
+			for (size_t c = 0; c < NUM_PRIORITIES; ++c)
+				if (ITask *task = findTask(index, c))
+					return task;
+			return nullptr;
+		}
+		
+		Worker &worker = *workers[index];
+		Clock::time_point now;
+		bool hasNow = false;
+		size_t aged = NUM_PRIORITIES;
+		for (size_t c = 1; c < NUM_PRIORITIES; ++c)
+		{
+			if (worker.passedOverSince[c] == Clock::time_point::max())
+				continue;
+			
+			if (!hasNow)
+			{
+				now = Clock::now();
+				hasNow = true;
+			}
+			
+			// the class passed over the longest, if more than one is overdue
+			if (now - worker.passedOverSince[c] > AGING_LIMITS[c] &&
+				(aged == NUM_PRIORITIES || worker.passedOverSince[c] < worker.passedOverSince[aged]))
+				aged = c;
+		}
+		
+		if (aged < NUM_PRIORITIES)
+			if (ITask *task = findTask(index, aged))
+			{
+				notePassedOver(worker, aged, true);
+				return task;
+			}
+		
+		for (size_t c = 0; c < NUM_PRIORITIES; ++c)
+			if (ITask *task = findTask(index, c))
+			{
+				notePassedOver(worker, c, false);
+				return task;
+			}
+		return nullptr;
+	}
+	
+	// Within a class, the tasks with a deadline are taken first, then those in the deque of the worker, then those in
+	// the injection queue, and last those stolen from the other workers, starting from a random one, or from all of
+	// them if index is not that of a worker.
+	ITask *findTask(size_t index, size_t c)
+	{
+		ClassQueues &queues = classQueues[c];
+		if (queues.numQueued <= 0)
+			return nullptr;
+		
+		ITask *task = nullptr;
+		if (queues.numDeadlines > 0)
+		{
+			std::unique_lock<std::mutex> lock(queues.deadlineMutex);
+			if (!queues.deadlineHeap.empty())
+			{
+				std::pop_heap(queues.deadlineHeap.begin(), queues.deadlineHeap.end(), isLaterDeadline);
+				task = queues.deadlineHeap.back();
+				queues.deadlineHeap.pop_back();
+				--queues.numDeadlines;
+			}
+		}
+		
+		if (!task && index < poolSize)
+			task = workers[index]->deques[c].pop();
+		if (!task)
+			task = queues.injectionQueue.pop();
+		
+		const size_t first = (index < poolSize) ? workers[index]->rng() % poolSize : 0;
+		for (size_t i = 0; i < poolSize && !task; ++i)
+		{
+			const size_t victim = (first + i) % poolSize;
+			if (victim != index)
+				task = workers[victim]->deques[c].steal();
+		}
+		
+		if (task)
+			--queues.numQueued;
+		return task;
+	}
+	
+	// The worker took a task of class c, so the other classes that still have tasks are passed over from now on,
+	// unless they already were, and the others no longer are. An overdue class gets a single task per aging window:
+	// if it still has tasks, its window starts over, so that it takes a bounded share of the worker away from the
+	// more urgent classes rather than all of it until it has caught up. The most urgent class is never passed over
+	// for long, as it goes first whenever no other class is overdue.
+	void notePassedOver(Worker &worker, size_t c, bool isOverdue)
+	{
+		Clock::time_point now;
+		bool hasNow = false;
+		for (size_t d = 1; d < NUM_PRIORITIES; ++d)
+		{
+			if (d == c && !isOverdue)
+			{
+				worker.passedOverSince[d] = Clock::time_point::max();
+				continue;
+			}
+			
+			if (classQueues[d].numQueued <= 0)
+				worker.passedOverSince[d] = Clock::time_point::max();
+			else if (worker.passedOverSince[d] == Clock::time_point::max() || d == c)
+			{
+				if (!hasNow)
+				{
+					now = Clock::now();
+					hasNow = true;
+				}
+				worker.passedOverSince[d] = now;
+			}
+		}
+	}
+	
+	// counts how long a task waited in the queues, by its own class, whichever queue it was in
+	void recordWait(Worker &worker, const ITask &task)
+	{
+		const Clock::time_point now = Clock::now();
+		const size_t c = static_cast<size_t>(task.priority);
+		const uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(now - task.enqueueTime).count();
+		
+		std::atomic<uint64_t> &bucket = worker.waitBuckets[c][LatencyHistogram::getBucket(microseconds)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if (now > task.deadline)
+			worker.numMissedDeadlines[c].store(worker.numMissedDeadlines[c].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+	
+	// tasks are taken off the queues only to be run, or to be dropped once the pool is cancelling
+	bool canRun() const
+	{
+		return isCancelling || (isStarted && !isPaused);
+	}
+	
+	// notifies shutdown() and waitIdle() when the last task is done
+	void releasePending()
+	{
+		if (--numPending == 0)
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			idleCV.notify_all();
+		}
+	}
+	
+	// cancels a task taken off the queues without running it
+	void dropTask(ITask *task)
+	{
+		task->token->setState(ITask::TaskState::Cancelled);
+		++numDroppedTasks;
+		task->release();
+		releasePending();
+	}
+	
+	// releases the tasks dropped with the queue mutex held, once it is no longer held, as releasing a task may add
+	// others
+	void releaseTasks(const std::vector<ITask *> &tasks)
+	{
+		for (ITask *task : tasks)
+			task->release();
+	}
+	
+	// moves the parked tasks that are no longer asked to pause back into the injection queue, and drops the
+	// cancelled ones into dropped, with the queue mutex held
+	void requeuePausedTasks(std::vector<ITask *> &dropped)
+	{
+		for (auto it = pausedTasks.begin(); it != pausedTasks.end();)
+		{
+			TaskToken &token = *(*it)->token;
+			if (token.isPauseRequested())
+			{
+				++it;
+				continue;
+			}
+			
+			if (token.isCancelRequested())
+			{
+				token.setState(ITask::TaskState::Cancelled);
+				++numDroppedTasks;
+				dropped.push_back(*it);
+			}
+			else
+			{
+				token.setState(ITask::TaskState::Waiting);
+				++numPending;
+				pushTask(*it, nullptr);
+			}
+			it = pausedTasks.erase(it);
+		}
+	}
+	
+	// Publishes the task a worker runs, so that pause(), resume() and shutdown() can make their request of it. A task
+	// that starts once the pool is paused or cancelling gets the request here instead.
+	void setCurrent(Worker &worker, TaskToken *token)
+	{
+		std::unique_lock<std::mutex> lock(worker.currentMutex);
+		worker.current = token;
+		if (!token)
+			return;
+		
+		if (isCancelling)
+			token->requestCancel();
+		else if (isPaused && isAccepting)
+			token->requestPause();
+	}
+	
+	// Runs a task unless it was asked to pause or to be cancelled while it was queued, or the pool was paused or
+	// is cancelling in the meantime. A task that returns because it was asked to pause is parked, one that is done
+	// is finished, and one that was resumed before it could be parked goes back to the deque of the worker. Only
+	// parking takes the queue mutex, so that pause(), resume() and shutdown() see either the running or the parked
+	// task, never neither.
+	void runTask(ITask *job, Worker &worker)
+	{
+		TaskToken &token = *job->token;
+		setCurrent(worker, &token);
+		
+		bool isDone = false;
+		if (!token.stopRequested())
+		{
+			recordWait(worker, *job);
+			token.setState(ITask::TaskState::Running);
+			token.countRun();
+			isDone = job->run();
+		}
+		
+		if (isDone || token.isCancelRequested())
+		{
+			setCurrent(worker, nullptr);
+			if (isDone)
+			{
+				token.setState(ITask::TaskState::Finished);
+				++numFinishedTasks;
+			}
+			else
+			{
+				token.setState(ITask::TaskState::Cancelled);
+				++numDroppedTasks;
+			}
+		}
+		else
+		{
+			// the task may be run and deleted by another worker as soon as it is parked or queued again
+			std::unique_lock<std::mutex> lock(queueMutex);
+			setCurrent(worker, nullptr);
+			if (token.isPauseRequested() && isAccepting)
+			{
+				token.setState(ITask::TaskState::Paused);
+				pausedTasks.push_back(job);
+				job = nullptr;
+			}
+			else // resumed before it was parked, or before it got to return, or the pool is being drained
+			{
+				token.requestResume();
+				++numPending;
+				pushTask(job, &worker);
+				job = nullptr;
+			}
+		}
+		
+		// released before the task stops being pending, as it may add others
+		if (job)
+			job->release();
+		releasePending();
+	}
+	
+	// The primary function for orchestrating the task system. A worker out of tasks looks for some a few times,
+	// yielding in between, before it goes to sleep, as waking it up costs more than that.
+	void wait(size_t index)
+	{
+		getWorkerContext() = {this, index};
+		Worker &worker = *workers[index];
+		const int NUM_SEARCHES = 16;
+		
+		while (true)
+		{
+			if (isShuttingDown)
+				break;
+			
+			ITask *task = nullptr;
+			for (int i = 0; i < NUM_SEARCHES && !task && canRun(); ++i)
+			{
+				task = findTask(index);
+				if (!task)
+					std::this_thread::yield();
+			}
+			
+			if (task)
+			{
+				runTask(task, worker);
+				continue;
+			}
+			
+			// go to waiting state
+			std::unique_lock<std::mutex> lock(waitMutex);
+			++numSleeping;
+			waitCV.wait(lock, [this]()
+			{
+				// conditions for waking up the threads
+				return (canRun() && tasksAvailable()) || isShuttingDown;
+			});
+			--numSleeping;
+		}
+		
+		getWorkerContext() = {nullptr, 0};
+	}
 	
-	// pauses all execution of tasks by putting the threads in the waiting state
-	void pause()
+	const size_t poolSize;
+	const size_t nThreads;	
+	const bool isPrioritized;
+	
+	std::vector<std::thread> pool;
+	std::vector<std::unique_ptr<Worker>> workers;
+	ClassQueues classQueues[NUM_PRIORITIES];
+	std::vector<ITask *> pausedTasks; // parked until resumed or cancelled, guarded by the queue mutex
+	
+	std::mutex waitMutex;
+	std::mutex queueMutex;
+	
+	std::condition_variable waitCV;
+	std::condition_variable idleCV; // notified when the last pending task is done, waited on with the queue mutex
+	
+	std::atomic<size_t> numPending; // tasks queued or running, but not parked
+	std::atomic<size_t> numSleeping; // workers waiting on the wait condition variable
+	std::atomic<size_t> numFinishedTasks;
+	std::atomic<size_t> numDroppedTasks;
+	
+	std::atomic<bool> isStarted;
+	std::atomic<bool> isPaused;	
+	std::atomic<bool> isAccepting;
+	std::atomic<bool> isCancelling;
+	std::atomic<bool> isShuttingDown;	
+};
+
+// A graph of dependent tasks, run on a ThreadPool. Nodes are added with addNode() and ordered with addEdge(), then
+// run() queues the nodes without predecessors and returns, and wait() blocks until every node has run. The worker
+// that finishes a node adds the successors that became ready to its own deque, so they run next on the same worker,
+// where the data the node left behind is still in cache, unless an idle worker steals them. The nodes, their edges
+// and tokens are allocated once, and the graph can be run again as many times as needed, as long as it has no cycles
+// and is not changed while it runs. A node that throws, or that the pool drops, stops the run: the nodes that did not
+// start yet are skipped, and wait() rethrows the exception or throws broken_promise.
+class TaskGraph
+{
+	
+public:
+	typedef size_t NodeId;
+	
+	TaskGraph() :
+		pool(nullptr),
+		numRemaining(0),
+		isRunning(false),
+		isStopped(false)
 	{
-		if (!isStarted)
+	}
+	
+	// waits for a run that is still going, without rethrowing what it ended with, as a destructor must not throw
+	~TaskGraph()
+	{
+		waitDone();
+	}
+	
+	NodeId addNode(std::function<void()> work, Priority priority = Priority::Normal)
+	{
+		nodes.emplace_back(new Node(this, std::move(work)));
+		nodes.back()->priority = priority;
+		return nodes.size() - 1;
+	}
+	
+	// to runs once from is finished
+	void addEdge(NodeId from, NodeId to)
+	{
+		nodes[from]->successors.push_back(nodes[to].get());
+		++nodes[to]->numPredecessors;
+	}
+	
+	void run(ThreadPool &pool_)
+	{
+		std::unique_lock<std::mutex> lock(doneMutex);
+		if (isRunning)
 		{
-			std::cout << "Task execution has not been started yet. Invalid operation!\n";
+			std::cout << "The task graph is already running. Skipping operation...\n";
 			return;
 		}
 		
-		isPaused = true;
-		paused = true;
-		resumed = false;
-		waitCV.notify_all();
+		if (nodes.empty())
+			return;
+		
+		pool = &pool_;
+		exception = nullptr;
+		isStopped = false;
+		isRunning = true;
+		numRemaining = nodes.size();
+		skipped.reserve(nodes.size());
+		for (auto &node : nodes)
+		{
+			node->numWaiting = node->numPredecessors;
+			node->token->reset();
+		}
+		lock.unlock();
+		
+		for (auto &node : nodes)
+			if (node->numPredecessors == 0)
+				pool->addTask(node.get());
 	}
 	
-	// resumes execution of tasks
-	void resume()
+	// not to be called from a task of the pool running the graph, which would take a worker away from it
+	void wait()
 	{
-		if (!isStarted)
+		std::unique_lock<std::mutex> lock = waitDone();
+		if (exception)
+			std::rethrow_exception(exception);
+		if (isStopped)
+			throw std::future_error(std::future_errc::broken_promise);
+	}
+	
+	size_t size() const { return nodes.size(); }
+	
+private:
+	struct Node : public ITask
+	{
+		Node(TaskGraph *graph_, std::function<void()> &&work_) :
+			graph(graph_),
+			work(std::move(work_)),
+			numPredecessors(0),
+			numWaiting(0)
 		{
-			std::cout << "Task execution has not been started yet. Invalid operation!\n";
-			return;
+			token = std::make_shared<TaskToken>();
 		}
 		
-		if (isPaused)
+		// a node that is skipped counts as cancelled, not finished
+		bool run() override
 		{
-			isPaused = false;
-			paused = false;
-			resumed = true;
-			waitCV.notify_all();
+			if (graph->isStopped)
+			{
+				token->requestCancel();
+				return false;
+			}
+			
+			try
+			{
+				work();
+			}
+			catch (...)
+			{
+				graph->stop(std::current_exception());
+			}
+			return true;
+		}
+		
+		void release() override
+		{
+			graph->onNodeDone(this);
 		}
+		
+		TaskGraph *graph;
+		std::function<void()> work;
+		std::vector<Node *> successors;
+		int numPredecessors;
+		std::atomic<int> numWaiting; // predecessors that are not done yet in this run
+	};
+	
+	// blocks until the run is over and returns with the done mutex held, so that its outcome can be read
+	std::unique_lock<std::mutex> waitDone()
+	{
+		std::unique_lock<std::mutex> lock(doneMutex);
+		doneCV.wait(lock, [this]() { return !isRunning; });
+		return lock;
 	}
 	
-	// stops all execution of tasks and shuts down the threadpool
-	void shutdown()
+	// keeps the first exception thrown in this run
+	void stop(std::exception_ptr exception_)
 	{
-		isShuttingDown = true;
-		shuttingDown = true;
+		std::unique_lock<std::mutex> lock(doneMutex);
+		if (!exception)
+			exception = exception_;
+		isStopped = true;
+	}
+	
+	// Called by the pool once it is done with a node, which it either ran or dropped. The ready successors are
+	// added to the pool, or skipped once the run is stopped.
+	void onNodeDone(Node *node)
+	{
+		if (node->token->getState() != ITask::TaskState::Finished)
+			isStopped = true;
 		
-		while (numFinishedThreads != poolSize)
-			waitCV.notify_all();
-	}	
+		for (Node *successor : node->successors)
+		{
+			if (--successor->numWaiting != 0)
+				continue;
+			
+			if (isStopped)
+				skip(successor);
+			else
+				pool->addTask(successor);
+		}
+		
+		finishNode();
+	}
+	
+	// Skips a node that became ready after the run was stopped, and all the nodes that become ready in turn, in a
+	// loop rather than through recursion, as a pipeline can be deep. Each node is skipped at most once per run, so
+	// the list never grows past its reserved size.
+	void skip(Node *node)
+	{
+		size_t numSkipped = 0;
+		std::unique_lock<std::mutex> lock(skipMutex);
+		skipped.push_back(node);
+		while (!skipped.empty())
+		{
+			Node *skippedNode = skipped.back();
+			skipped.pop_back();
+			skippedNode->token->setState(ITask::TaskState::Cancelled);
+			++numSkipped;
+			
+			for (Node *successor : skippedNode->successors)
+				if (--successor->numWaiting == 0)
+					skipped.push_back(successor);
+		}
+		lock.unlock();
+		
+		finishNode(numSkipped);
+	}
+	
+	// the graph may be destroyed as soon as the last node is finished, so this is the last thing done with it
+	void finishNode(size_t count = 1)
+	{
+		if ((numRemaining -= count) == 0)
+		{
+			std::unique_lock<std::mutex> lock(doneMutex);
+			isRunning = false;
+			doneCV.notify_all();
+		}
+	}
+	
+	std::vector<std::unique_ptr<Node>> nodes;
+	ThreadPool *pool; // of the current run
+	
+	std::vector<Node *> skipped; // guarded by the skip mutex
+	std::mutex skipMutex;
+	
+	std::mutex doneMutex;
+	std::condition_variable doneCV;
+	std::exception_ptr exception; // guarded by the done mutex
+	
+	std::atomic<size_t> numRemaining; // nodes not yet run or skipped in this run
+	std::atomic<bool> isRunning;
+	std::atomic<bool> isStopped;
+};
+
+// The task queue as it was before the work-stealing deques, kept as the baseline of the benchmark: the scheduling
+// loop, addTask() and runTask() of that pool, with its new and reentrant queues behind one mutex, the token list, and
+// the pause checks, which take the mutex twice per poll as well. Only the public operations that the benchmark does
+// not use are left out, so the pool starts right away and is never paused.
+class LockedQueuePool
+{
+	
+public:
+	explicit LockedQueuePool(size_t poolSize) :
+		numTokensKept(0),
+		numRunning(0),
+		numFinishedTasks(0),
+		numDroppedTasks(0),
+		isStarted(true),
+		isPaused(false),
+		isShuttingDown(false)
+	{
+		for (size_t i = 0; i < poolSize; ++i)
+			pool.push_back(std::thread([this]() { wait(); }));
+	}
+	
+	~LockedQueuePool()
+	{
+		waitIdle();
+		isShuttingDown = true;
+		notifyWorkers();
+		for (size_t i = 0; i < pool.size(); ++i)
+			pool[i].join();
+	}
 	
 	bool isQueueEmpty()
 	{
@@ -324,28 +1948,109 @@ public:
 		return taskQueue.empty();
 	}
 	
-	// checks if there are partially finished but saved tasks in the queue
 	bool resumedTasksAvailable()
 	{
 		std::unique_lock<std::mutex> lock(queueMutex);
 		return !reentrantQueue.empty();
 	}
 	
-	// checks if there are new or partially finished (saved) tasks in the queue
 	bool tasksAvailable()
 	{
 		return !isQueueEmpty() || resumedTasksAvailable();
 	}
 	
-	void addTask(std::unique_ptr<ITask> &&task)
+	std::shared_ptr<TaskToken> addTask(std::unique_ptr<ITask> &&task)
 	{
+		std::shared_ptr<TaskToken> token = task->token;
+		
 		std::unique_lock<std::mutex> lock(queueMutex);
+		if (tokens.size() >= 2 * std::max(numTokensKept, static_cast<size_t>(64)))
+		{
+			tokens.erase(std::remove_if(tokens.begin(), tokens.end(), [](const std::shared_ptr<TaskToken> &t)
+			{
+				return t->isDone();
+			}), tokens.end());
+			numTokensKept = tokens.size();
+		}
+		
+		tokens.push_back(token);
 		taskQueue.push(std::move(task));
-	}	
+		lock.unlock();
+		
+		notifyWorker();
+		return token;
+	}
+	
+	// the drain condition of the old shutdown()
+	void waitIdle()
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		idleCV.wait(lock, [this]()
+		{
+			return taskQueue.empty() && reentrantQueue.empty() && pausedTasks.empty() && numRunning == 0;
+		});
+	}
 	
 private:
-
-	// the primary function for orchestrating the task system
+	void notifyWorkers()
+	{
+		std::unique_lock<std::mutex> lock(waitMutex);
+		waitCV.notify_all();
+	}
+	
+	void notifyWorker()
+	{
+		std::unique_lock<std::mutex> lock(waitMutex);
+		waitCV.notify_one();
+	}
+	
+	bool popTask(std::queue<std::unique_ptr<ITask>> &queue, std::unique_ptr<ITask> &job)
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		if (queue.empty())
+			return false;
+		
+		job = std::move(queue.front());
+		queue.pop();
+		++numRunning;
+		return true;
+	}
+	
+	void runTask(std::unique_ptr<ITask> &&job)
+	{
+		TaskToken &token = *job->token;
+		
+		bool isDone = false;
+		if (!token.stopRequested())
+		{
+			token.setState(ITask::TaskState::Running);
+			token.countRun();
+			isDone = job->run();
+		}
+		
+		std::unique_lock<std::mutex> lock(queueMutex);
+		if (isDone)
+		{
+			token.setState(ITask::TaskState::Finished);
+			++numFinishedTasks;
+		}
+		else if (token.isCancelRequested())
+		{
+			token.setState(ITask::TaskState::Cancelled);
+			++numDroppedTasks;
+		}
+		else if (token.isPauseRequested())
+		{
+			token.setState(ITask::TaskState::Paused);
+			pausedTasks.push_back(std::move(job));
+		}
+		else
+			reentrantQueue.push(std::move(job));
+		
+		--numRunning;
+		idleCV.notify_all();
+	}
+	
 	void wait()
 	{
 		std::unique_ptr<ITask> job;
@@ -353,95 +2058,262 @@ private:
 		while (true)
 		{
 			if (isShuttingDown)
-			{
-				++numFinishedThreads;				
 				break;
-			}
-			else if (!isQueueEmpty() && isStarted && !isPaused)
-			{
-				std::unique_lock<std::mutex> lock(queueMutex);
-				job = std::move(taskQueue.front());
-				taskQueue.pop();
-				lock.unlock();
-				Task<void>* t = static_cast<Task<void>*>(job.get());
-				t->run();
-				
-				// save the partially finished task in 
-				// case it was paused 				
-				if (isPaused)
-					reentrantQueue.push(std::move(job));				
-			}
-			else if (resumedTasksAvailable() && !isPaused)
-			{
-				std::unique_lock<std::mutex> lock(queueMutex);
-				job = std::move(reentrantQueue.front());				
-				reentrantQueue.pop();
-				lock.unlock();
-				Task<void>* resumedTask = static_cast<Task<void>*>(job.get());
-				resumedTask->run();
-				
-				// save the remaining part of the partially finished
-				// task in case it was paused
-				if (isPaused)
-					reentrantQueue.push(std::move(job));
-			}
-			else // go to waiting state
+			else if (isStarted && !isPaused && popTask(taskQueue, job))
+				runTask(std::move(job));
+			else if (isStarted && !isPaused && popTask(reentrantQueue, job))
+				runTask(std::move(job));
+			else
 			{
 				std::unique_lock<std::mutex> lock(waitMutex);
 				waitCV.wait(lock, [&, this]()
 				{
-					// conditions for waking up the threads
-					return !isPaused && (!isQueueEmpty() || resumedTasksAvailable()) || isShuttingDown;
+					return (isStarted && !isPaused && tasksAvailable()) || isShuttingDown;
 				});
 			}
 		}
 	}
-
-	const size_t poolSize;
-	const size_t nThreads;	
 	
 	std::vector<std::thread> pool;
 	std::queue<std::unique_ptr<ITask>> taskQueue;
 	std::queue<std::unique_ptr<ITask>> reentrantQueue;
+	std::vector<std::unique_ptr<ITask>> pausedTasks;
+	std::vector<std::shared_ptr<TaskToken>> tokens;
+	size_t numTokensKept;
 	
 	std::mutex waitMutex;
 	std::mutex queueMutex;
 	
 	std::condition_variable waitCV;
+	std::condition_variable idleCV;
+	
+	// guarded by the queue mutex
+	size_t numRunning;
+	size_t numFinishedTasks;
+	size_t numDroppedTasks;
+	
+	std::atomic<bool> isStarted;
+	std::atomic<bool> isPaused;
+	std::atomic<bool> isShuttingDown;
+};
+
+// An empty task for the benchmark, which adds two children one level less deep, if any, to the pool it runs in
+template
+<typename Pool>
+struct BenchmarkTask : public ITask
+{
+	Pool *pool;
+	int depth;
+	
+	BenchmarkTask(Pool *pool_, int depth_) :
+		pool(pool_),
+		depth(depth_)
+	{
+		token = std::make_shared<TaskToken>();
+		token->setState(TaskState::Waiting);
+	}
+	
+	bool run() override
+	{
+		if (depth > 0)
+		{
+			pool->addTask(std::unique_ptr<ITask>(new BenchmarkTask(pool, depth - 1)));
+			pool->addTask(std::unique_ptr<ITask>(new BenchmarkTask(pool, depth - 1)));
+		}
+		return true;
+	}
+};
+
+// Returns the throughput in tasks per second of numTasks empty tasks, either all added from this thread, or added by
+// the tasks themselves in binary trees of 2047 tasks, which is the case the per-worker deques are meant for.
+template
+<typename Pool>
+double measureThroughput(Pool &pool, size_t numTasks, bool isSpawned)
+{
+	const int TREE_DEPTH = 10;
+	const size_t TREE_SIZE = (size_t(2) << TREE_DEPTH) - 1;
+	
+	auto begin = std::chrono::steady_clock::now();
+	if (isSpawned)
+	{
+		const size_t numTrees = std::max(numTasks / TREE_SIZE, size_t(1));
+		for (size_t i = 0; i < numTrees; ++i)
+			pool.addTask(std::unique_ptr<ITask>(new BenchmarkTask<Pool>(&pool, TREE_DEPTH)));
+		numTasks = numTrees * TREE_SIZE;
+	}
+	else
+	{
+		for (size_t i = 0; i < numTasks; ++i)
+			pool.addTask(std::unique_ptr<ITask>(new BenchmarkTask<Pool>(&pool, 0)));
+	}
+	pool.waitIdle();
 	
-	std::atomic<int> numFinishedThreads;
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+	return numTasks / elapsed.count();
+}
+
+// the best throughput in millions of tasks per second out of a few runs
+template
+<typename Pool>
+double getBestThroughput(Pool &pool, size_t numTasks, bool isSpawned)
+{
+	const int NUM_RUNS = 3;
+	double best = 0.0;
+	for (int i = 0; i < NUM_RUNS; ++i)
+		best = std::max(best, measureThroughput(pool, numTasks, isSpawned) / 1e6);
+	return best;
+}
+
+// Compares the throughput of empty tasks of the locked queue and of the work-stealing deques, from 1 to maxThreads
+// workers, as that is where the scheduling overhead shows. The results are printed once all are in, after the
+// messages of the pools.
+void benchmark(size_t numTasks, size_t maxThreads)
+{
+	std::vector<std::vector<double>> results;
+	for (size_t n = 1; n <= maxThreads; ++n)
+	{
+		std::vector<double> row;
+		{
+			LockedQueuePool lockedPool(n);
+			row.push_back(getBestThroughput(lockedPool, numTasks, false));
+			row.push_back(getBestThroughput(lockedPool, numTasks, true));
+		}
+		{
+			ThreadPool threadPool(n);
+			threadPool.init();
+			threadPool.start();
+			row.push_back(getBestThroughput(threadPool, numTasks, false));
+			row.push_back(getBestThroughput(threadPool, numTasks, true));
+		}
+		results.push_back(row);
+	}
 	
-	bool isStarted;
-	bool isPaused;	
-	bool isShuttingDown;	
+	std::cout << "\nEmpty task throughput in Mtasks/s, " << numTasks << " tasks, best of 3 runs\n";
+	std::cout << "threads  locked/added  stealing/added  locked/spawned  stealing/spawned\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		std::printf("%7zu  %12.3f  %14.3f  %14.3f  %16.3f\n",
+					i + 1, results[i][0], results[i][2], results[i][1], results[i][3]);
+	}
+}
+
+// busy waits for the given time, as the work of a task
+void spinFor(std::chrono::microseconds duration)
+{
+	const Clock::time_point end = Clock::now() + duration;
+	while (Clock::now() < end)
+		;
+}
+
+// an input event, which the interactive task that handles it takes over
+struct InputEvent
+{
+	std::chrono::microseconds work;
 };
 
-int main()
+void handleEvent(std::unique_ptr<InputEvent> event)
+{
+	spinFor(event->work);
+}
+
+// Measures the queue wait of short interactive tasks, added every millisecond with a deadline of a millisecond,
+// while a backlog of background tasks is being worked off, once with every task queued first in first out, and once
+// with the priority classes. The backlog takes about twice as long as adding the interactive tasks, so that every
+// one of them comes in while it is still there.
+void benchmarkPriorities(size_t nThreads)
+{
+	const size_t NUM_BACKGROUND = 20000 * nThreads;
+	const size_t NUM_INTERACTIVE = 200;
+	const std::chrono::microseconds BACKGROUND_WORK(20);
+	const std::chrono::microseconds INTERACTIVE_WORK(5);
+	const std::chrono::milliseconds INTERVAL(1);
+	
+	std::vector<std::pair<LatencyHistogram, LatencyHistogram>> results;
+	for (bool isPrioritized : {false, true})
+	{
+		ThreadPool threadPool(nThreads, isPrioritized);
+		threadPool.init();
+		threadPool.start();
+		
+		for (size_t i = 0; i < NUM_BACKGROUND; ++i)
+			threadPool.submit(Priority::Background, NO_DEADLINE, spinFor, BACKGROUND_WORK);
+		
+		for (size_t i = 0; i < NUM_INTERACTIVE; ++i)
+		{
+			threadPool.submit(Priority::Interactive, Clock::now() + INTERVAL, handleEvent,
+							  std::make_unique<InputEvent>(InputEvent{INTERACTIVE_WORK}));
+			std::this_thread::sleep_for(INTERVAL);
+		}
+		threadPool.waitIdle();
+		
+		results.push_back(std::make_pair(threadPool.getLatencyHistogram(Priority::Interactive),
+										 threadPool.getLatencyHistogram(Priority::Background)));
+	}
+	
+	std::cout << "\nQueue wait in us under mixed load, " << NUM_INTERACTIVE << " interactive tasks of 5 us every 1 ms among "
+			  << NUM_BACKGROUND << " background tasks of 20 us, " << nThreads << " threads\n";
+	std::cout << "scheduling   class             p50       p99       max  missed deadlines\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const char *scheduling = (i == 0) ? "fifo" : "priorities";
+		const LatencyHistogram *histograms[] = {&results[i].first, &results[i].second};
+		const Priority priorities[] = {Priority::Interactive, Priority::Background};
+		for (size_t j = 0; j < 2; ++j)
+		{
+			std::printf("%-11s  %-12s  %8llu  %8llu  %8llu  %16llu\n", (j == 0) ? scheduling : "",
+						getPriorityName(priorities[j]).c_str(),
+						static_cast<unsigned long long>(histograms[j]->getPercentile(0.5)),
+						static_cast<unsigned long long>(histograms[j]->getPercentile(0.99)),
+						static_cast<unsigned long long>(histograms[j]->getPercentile(1.0)),
+						static_cast<unsigned long long>(histograms[j]->numMissedDeadlines));
+		}
+	}
+}
+
+int main(int argc, char **argv)
 {
+	// --benchmark [tasks [threads]] compares the task queues instead of running the demo
+	if (argc > 1 && std::strcmp(argv[1], "--benchmark") == 0)
+	{
+		size_t numTasks = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+		size_t maxThreads = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : std::thread::hardware_concurrency();
+		benchmark(std::max(numTasks, size_t(1)), std::max(maxThreads, size_t(1)));
+		return 0;
+	}
+	
+	// --benchmark-priorities [threads] compares the queue wait of interactive tasks with and without priorities
+	if (argc > 1 && std::strcmp(argv[1], "--benchmark-priorities") == 0)
+	{
+		size_t nThreads = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+		benchmarkPriorities(std::max(nThreads, size_t(1)));
+		return 0;
+	}
+	
 	std::queue<int> eventQueue;
 	ThreadPool threadPool;
 	threadPool.init();
 	int event = 0, input = 0;	
+	std::vector<std::shared_ptr<TaskToken>> tasks; // producers first, then consumers
 	
 	for (int i = 0; i < nProd; ++i)
 	{
-		std::function<void()> prodfn(std::bind(&produce, i));
+		std::function<void(TaskToken &)> prodfn(std::bind(&produce, i, std::placeholders::_1));
 		std::unique_ptr<ITask> prodTask = std::make_unique<Task<void>>(std::ref(prodfn));
-		threadPool.addTask(std::move(prodTask));
+		tasks.push_back(threadPool.addTask(std::move(prodTask)));
 	}
 		
 	for (int i = 0; i < nCon; ++i)
 	{
-		std::function<void()> consfn(std::bind(&consume, i));
+		std::function<void(TaskToken &)> consfn(std::bind(&consume, i, std::placeholders::_1));
 		std::unique_ptr<ITask> consTask = std::make_unique<Task<void>>(std::ref(consfn));
-		threadPool.addTask(std::move(consTask));
+		tasks.push_back(threadPool.addTask(std::move(consTask)));
 	}
 	
 	// event loop for handling user input
 	while (true)
 	{
 		std::this_thread::sleep_for(std::chrono::seconds(1));
-		std::cout << "Start/Pause/Resume/Quit ? (4/5/6/7)\n";
+		std::cout << "Start/Pause/Resume/Quit ? (4/5/6/7), or Pause/Resume/Cancel a single task ? (8/9/10)\n";
 		std::cin >> input;
 		std::cout << "Input event: " << input << "\n";
 		eventQueue.push(input);
@@ -470,11 +2342,41 @@ int main()
 			threadPool.resume();		
 			continue;
 		}
+		
+		if (event >= 8 && event <= 10) // 8, 9 or 10 to pause, resume or cancel a single task
+		{
+			std::cout << "Which task? (producers 0 - " << nProd - 1 << " / consumers " << nProd << " - " << nProd + nCon - 1 << ")\n";
+			std::cin >> input;
+			
+			if (input < 0 || input >= static_cast<int>(tasks.size()))
+			{
+				std::cout << "Invalid task!\n";
+				continue;
+			}
+			
+			if (event == 8)
+				threadPool.pauseTask(tasks[input]);
+			else if (event == 9)
+				threadPool.resumeTask(tasks[input]);
+			else
+				threadPool.cancelTask(tasks[input]);
+			continue;
+		}
 			
 		if (event == 7) // 7 to quit
 			break;		
 	}
+	std::cout << "How many seconds may the queued tasks take to finish? (0 = cancel them right away)\n";
+	std::cin >> input;
 	std::cout << "Shutting down...\n";
-	threadPool.shutdown();
+	
+	ThreadPool::ShutdownReport report;
+	if (input > 0)
+		report = threadPool.shutdown(ThreadPool::ShutdownMode::Drain, std::chrono::seconds(input));
+	else
+		report = threadPool.shutdown(ThreadPool::ShutdownMode::Cancel);
+	
+	std::cout << "Drained " << report.numDrained << " tasks and dropped " << report.numDropped << " tasks"
+			  << (report.isTimedOut ? " once the time ran out.\n" : ".\n");
 	return 0;
-}
\ No newline at end of file
+}
@@ -4,37 +4,39 @@
 #include <cmath>
 
 #include "omp.h"
+#include "AlignedBuffer.h"
 
 struct TriangleList
 {
+	// every array starts on a 2 MB boundary and is backed by huge pages where the kernel grants them
 	TriangleList(int size_) : size(size_)
 	{
-		vax = new float[size];
-		vay = new float[size];
-		vaz = new float[size];
+		vax = allocateArray<float>(size, PageSize::TransparentHuge);
+		vay = allocateArray<float>(size, PageSize::TransparentHuge);
+		vaz = allocateArray<float>(size, PageSize::TransparentHuge);
 		
-		vbx = new float[size];
-		vby = new float[size];
-		vbz = new float[size];
+		vbx = allocateArray<float>(size, PageSize::TransparentHuge);
+		vby = allocateArray<float>(size, PageSize::TransparentHuge);
+		vbz = allocateArray<float>(size, PageSize::TransparentHuge);
 		
-		vcx = new float[size];
-		vcy = new float[size];
-		vcz = new float[size];
+		vcx = allocateArray<float>(size, PageSize::TransparentHuge);
+		vcy = allocateArray<float>(size, PageSize::TransparentHuge);
+		vcz = allocateArray<float>(size, PageSize::TransparentHuge);
 	}
 	
 	~TriangleList()
 	{
-		delete [] vax;
-		delete [] vay;
-		delete [] vaz;
+		freeArray(vax, size);
+		freeArray(vay, size);
+		freeArray(vaz, size);
 		
-		delete [] vbx;
-		delete [] vby;
-		delete [] vbz;
+		freeArray(vbx, size);
+		freeArray(vby, size);
+		freeArray(vbz, size);
 		
-		delete [] vcx;
-		delete [] vcy;
-		delete [] vcz;
+		freeArray(vcx, size);
+		freeArray(vcy, size);
+		freeArray(vcz, size);
 	}
 	
 	float *vax;